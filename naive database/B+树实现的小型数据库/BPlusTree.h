@@ -2,21 +2,506 @@
 #define _BPLUSTREE_H_
 
 #include "MemoryHandler.h"
-#include <stack>
+#include "StringHandler.h"
+#include "ValueLog.h"
+#include "WriteBatch.h"
+#include "BloomFilter.h"
+#include "ValueCache.h"
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
 
 #define BTORDER (4)
+#define ROOTADDR (PAGESIZE+PageLayout<Node>::DATAOFFSET)
+#define MAXHEIGHT (64)
+#define INLINEVALUESIZE (sizeof(long long))
+#define INLINEKEYSIZE (sizeof(long long))
+#define SEPARATORTAG (1LL<<62)
 
 
-template<typename KeyType,typename ValueType>
+template<bool IsString>
+struct ThreeWay
+{
+    template<typename Left,typename Right>
+    static int compare(const Left& left,const Right& right)
+    {
+        if (left<right) return -1;
+        if (right<left) return 1;
+        return 0;
+    }
+};
+
+template<>
+struct ThreeWay<true>
+{
+    static int compare(const StringRef& left,const StringRef& right)
+    {
+        return left.compare(right);
+    }
+};
+
+struct KeyCompare
+{
+    typedef void is_transparent;
+    template<typename Left,typename Right>
+    int operator()(const Left& left,const Right& right) const
+    {
+        return ThreeWay<IsStringKey<Left>::value && IsStringKey<Right>::value>::compare(left,right);
+    }
+};
+
+struct KeyEqual
+{
+    template<typename Left,typename Right>
+    bool operator()(const Left& left,const Right& right) const
+    {
+        return KeyCompare()(left,right)==0;
+    }
+};
+
+template<typename Less>
+struct LessCompare
+{
+    Less less;
+    LessCompare(const Less& lessThan=Less()):less(lessThan){};
+    template<typename Left,typename Right>
+    int operator()(const Left& left,const Right& right) const
+    {
+        if (less(left,right)) return -1;
+        if (less(right,left)) return 1;
+        return 0;
+    }
+};
+
+template<typename KeyType>
+class InlineKeyHandler
+{
+public:
+    InlineKeyHandler(const char* fileName){};
+    long long insert(const KeyType* key)
+    {
+        long long addr=0;
+        memcpy(&addr,key,sizeof(KeyType));
+        return addr;
+    }
+    void remove(long long addr) {}
+    void removeBatch(long long* addr,int count) {}
+    void reset() {}
+    KeyType getValue(long long addr)
+    {
+        KeyType key;
+        memcpy(&key,&addr,sizeof(KeyType));
+        return key;
+    }
+    int getMappedPages() { return 0; }
+};
+
+template<typename KeyType>
+class InlineKeyGuard
+{
+public:
+    InlineKeyGuard(InlineKeyHandler<KeyType>* handler,long long address):key(handler->getValue(address)){};
+    const KeyType& operator*() const { return key; }
+    const KeyType* operator->() const { return &key; }
+private:
+    KeyType key;
+};
+
+template<typename KeyType,bool Inline=(std::is_trivially_copyable<KeyType>::value && sizeof(KeyType)<=INLINEKEYSIZE)>
+struct KeyStorage
+{
+    typedef MemoryHandler<KeyType> Handler;
+    typedef PageGuard<KeyType> Guard;
+};
+
+template<typename KeyType>
+struct KeyStorage<KeyType,true>
+{
+    typedef InlineKeyHandler<KeyType> Handler;
+    typedef InlineKeyGuard<KeyType> Guard;
+};
+
+template<>
+struct KeyStorage<string,false>
+{
+    typedef StringHandler Handler;
+    typedef StringGuard Guard;
+};
+
+template<typename KeyType>
+struct HashableKey
+{
+    enum { value=std::is_integral<KeyType>::value || std::is_enum<KeyType>::value || std::is_pointer<KeyType>::value
+                 || (std::is_floating_point<KeyType>::value && sizeof(KeyType)<=sizeof(double)) || IsStringKey<KeyType>::value };
+};
+
+template<typename KeyType,bool Float=std::is_floating_point<KeyType>::value>
+struct CanonicalKey
+{
+    static KeyType of(const KeyType& key) { return key; }
+};
+
+template<typename KeyType>
+struct CanonicalKey<KeyType,true>
+{
+    static KeyType of(const KeyType& key) { return key==0?KeyType(0):key; }
+};
+
+template<typename KeyType,bool IsString=IsStringKey<KeyType>::value>
+struct KeyHash
+{
+    static unsigned long long hash(const KeyType& key)
+    {
+        KeyType canonical=CanonicalKey<KeyType>::of(key);
+        return BloomFilter::hash((const char*)&canonical,sizeof(KeyType));
+    }
+};
+
+template<typename KeyType>
+struct KeyHash<KeyType,true>
+{
+    static unsigned long long hash(const StringRef& key)
+    {
+        return BloomFilter::hash(key.data,key.length);
+    }
+};
+
+template<bool Truncate>
+struct SeparatorPolicy
+{
+    template<typename Handler>
+    static long long make(Handler* handler,long long leftAddress,long long rightAddress) { return leftAddress; }
+    template<typename Handler>
+    static long long copy(Handler* handler,long long address) { return address; }
+    template<typename Handler>
+    static void drop(Handler* handler,long long address) {}
+    static long long address(long long address) { return address; }
+};
+
+template<>
+struct SeparatorPolicy<true>
+{
+    static long long make(StringHandler* handler,long long leftAddress,long long rightAddress)
+    {
+        string separator;
+        {
+            StringGuard left(handler,leftAddress);
+            StringGuard right(handler,rightAddress);
+            int prefix=0;
+            while (prefix<left->length && prefix<right->length && left->data[prefix]==right->data[prefix])
+                prefix++;
+            if (prefix+1>=left->length || prefix+1>=right->length)
+                return leftAddress;
+            separator.assign(right->data,prefix+1);
+        }
+        return handler->insert(&separator) | SEPARATORTAG;
+    }
+    static long long copy(StringHandler* handler,long long address)
+    {
+        if (!(address & SEPARATORTAG))
+            return address;
+        string separator=handler->getValue(address & ~SEPARATORTAG);
+        return handler->insert(&separator) | SEPARATORTAG;
+    }
+    static void drop(StringHandler* handler,long long address)
+    {
+        if (address & SEPARATORTAG)
+            handler->remove(address & ~SEPARATORTAG);
+    }
+    static long long address(long long address) { return address & ~SEPARATORTAG; }
+};
+
+struct ReservedValue
+{
+    long long length;
+    ReservedValue(long long size):length(size){};
+};
+
+struct KeepExisting
+{
+    bool operator()(long long& dataAddress) const { return false; }
+};
+
+struct InlineHandler
+{
+    InlineHandler(const char* fileName){};
+    void reset() {}
+    int getMappedPages() { return 0; }
+};
+
+template<typename ValueType,bool Inline=(std::is_trivially_copyable<ValueType>::value && sizeof(ValueType)<=INLINEVALUESIZE)>
+struct ValueStorage
+{
+    typedef MemoryHandler<ValueType> Handler;
+    template<typename... Args>
+    static long long store(Handler* handler,long long keyAddress,Args&&... args)
+    {
+        long long address=handler->allocate();
+        PageGuard<ValueType> slot(handler,address);
+        new (slot.get()) ValueType(std::forward<Args>(args)...);
+        return address;
+    }
+    static long long update(Handler* handler,long long address,const ValueType& value)
+    {
+        handler->update(address,&value);
+        return address;
+    }
+    template<typename Modifier>
+    static long long modify(Handler* handler,long long address,Modifier& modifier)
+    {
+        PageGuard<ValueType> slot(handler,address);
+        modifier(*slot);
+        return address;
+    }
+    static ValueType load(Handler* handler,long long address)
+    {
+        return handler->getValue(address);
+    }
+    static void release(Handler* handler,long long address)
+    {
+        handler->remove(address);
+    }
+    static void releaseBatch(Handler* handler,long long* address,int count)
+    {
+        handler->removeBatch(address,count);
+    }
+};
+
+template<typename ValueType>
+struct ValueStorage<ValueType,true>
+{
+    typedef InlineHandler Handler;
+    template<typename... Args>
+    static long long store(Handler* handler,long long keyAddress,Args&&... args)
+    {
+        ValueType value(std::forward<Args>(args)...);
+        return pack(value);
+    }
+    static long long update(Handler* handler,long long address,const ValueType& value)
+    {
+        return pack(value);
+    }
+    template<typename Modifier>
+    static long long modify(Handler* handler,long long address,Modifier& modifier)
+    {
+        ValueType value=load(handler,address);
+        modifier(value);
+        return pack(value);
+    }
+    static ValueType load(Handler* handler,long long address)
+    {
+        ValueType value;
+        memcpy(&value,&address,sizeof(ValueType));
+        return value;
+    }
+    static void release(Handler* handler,long long address) {}
+    static void releaseBatch(Handler* handler,long long* address,int count) {}
+    static long long pack(const ValueType& value)
+    {
+        long long address=0;
+        memcpy(&address,&value,sizeof(ValueType));
+        return address;
+    }
+};
+
+template<>
+struct ValueStorage<string,false>
+{
+    typedef StringHandler Handler;
+    static long long store(Handler* handler,long long keyAddress,const string& value)
+    {
+        return handler->insert(&value);
+    }
+    static long long store(Handler* handler,long long keyAddress,const ReservedValue& reserved)
+    {
+        return handler->reserve(reserved.length);
+    }
+    template<typename... Args>
+    static long long store(Handler* handler,long long keyAddress,Args&&... args)
+    {
+        string value(std::forward<Args>(args)...);
+        return handler->insert(&value);
+    }
+    static long long update(Handler* handler,long long address,const string& value)
+    {
+        return handler->update(address,&value);
+    }
+    template<typename Modifier>
+    static long long modify(Handler* handler,long long address,Modifier& modifier)
+    {
+        string value=handler->getValue(address);
+        modifier(value);
+        return handler->update(address,&value);
+    }
+    static string load(Handler* handler,long long address)
+    {
+        return handler->getValue(address);
+    }
+    static void release(Handler* handler,long long address)
+    {
+        handler->remove(address);
+    }
+    static void releaseBatch(Handler* handler,long long* address,int count)
+    {
+        handler->removeBatch(address,count);
+    }
+};
+
+template<typename ValueType>
+struct LogStorage
+{
+    typedef ValueLog<ValueType> Handler;
+    template<typename... Args>
+    static long long store(Handler* handler,long long keyAddress,Args&&... args)
+    {
+        ValueType value(std::forward<Args>(args)...);
+        return handler->append(keyAddress,&value);
+    }
+    static long long update(Handler* handler,long long address,const ValueType& value)
+    {
+        long long next=handler->append(handler->getKeyAddr(address),&value);
+        handler->remove(address);
+        return next;
+    }
+    template<typename Modifier>
+    static long long modify(Handler* handler,long long address,Modifier& modifier)
+    {
+        ValueType value=handler->getValue(address);
+        modifier(value);
+        return update(handler,address,value);
+    }
+    static ValueType load(Handler* handler,long long address)
+    {
+        return handler->getValue(address);
+    }
+    static void release(Handler* handler,long long address)
+    {
+        handler->remove(address);
+    }
+    static void releaseBatch(Handler* handler,long long* address,int count)
+    {
+        handler->removeBatch(address,count);
+    }
+};
+
+struct NoAggregate
+{
+    typedef char Type;
+    enum { enabled=0 };
+    static Type identity() { return 0; }
+    template<typename ValueType>
+    static Type lift(const ValueType& value) { return 0; }
+    static Type combine(const Type& left,const Type& right) { return 0; }
+};
+
+template<typename ValueType,typename Total=ValueType>
+struct SumAggregate
+{
+    typedef Total Type;
+    enum { enabled=1 };
+    static Type identity() { return Type(); }
+    static Type lift(const ValueType& value) { return Type(value); }
+    static Type combine(const Type& left,const Type& right) { return left+right; }
+};
+
+template<typename ValueType>
+struct MinAggregate
+{
+    typedef ValueType Type;
+    enum { enabled=1 };
+    static Type identity() { return std::numeric_limits<Type>::max(); }
+    static Type lift(const ValueType& value) { return value; }
+    static Type combine(const Type& left,const Type& right) { return right<left?right:left; }
+};
+
+template<typename ValueType>
+struct MaxAggregate
+{
+    typedef ValueType Type;
+    enum { enabled=1 };
+    static Type identity() { return std::numeric_limits<Type>::lowest(); }
+    static Type lift(const ValueType& value) { return value; }
+    static Type combine(const Type& left,const Type& right) { return left<right?right:left; }
+};
+
+template<typename KeyType,typename ValueType,typename Compare=KeyCompare,typename Storage=ValueStorage<ValueType>,typename Aggregate=NoAggregate >
 class BPlusMap
 {
 public:
-    BPlusMap(const char* indexFileName,const char* keyFileName,const char* dataFileName);
+    BPlusMap(const char* indexFileName,const char* keyFileName,const char* dataFileName,const Compare& compare=Compare());
     ~BPlusMap();
     void insert(const KeyType& key,const ValueType& value);
+    void insert(KeyType&& key,ValueType&& value);
+    template<typename... Args>
+    void emplace(const KeyType& key,Args&&... args);
     ValueType get(const KeyType& key);
     void remove(const KeyType& key);
+    long long eraseRange(const KeyType& low,const KeyType& high);
+    void apply(const WriteBatch<KeyType,ValueType>& batch);
+    long long size();
+    long long rank(const KeyType& key);
+    KeyType select(long long index);
+    long long count(const KeyType& low,const KeyType& high);
+    typename Aggregate::Type aggregate(const KeyType& low,const KeyType& high);
+    KeyType sample();
+    void clear();
     int update(const KeyType& key,const ValueType& value);
+    int insertOrAssign(const KeyType& key,const ValueType& value);
+    template<typename Modifier>
+    int upsert(const KeyType& key,const ValueType& value,Modifier modifier);
+    template<typename Modifier>
+    int modify(const KeyType& key,Modifier modifier);
+    bool find(const KeyType& key,long long& dataAddress);
+    bool contains(const KeyType& key);
+    bool tryGet(const KeyType& key,ValueType& value);
+    int tryUpdate(const KeyType& key,const ValueType& value);
+    PinnedValue<ValueType> getRef(const KeyType& key);
+    template<typename Visitor>
+    bool visit(const KeyType& key,Visitor visitor);
+    long long reserveValue(const KeyType& key,long long length);
+    long long valueLength(long long dataAddress);
+    int readValue(long long dataAddress,long long offset,char* buffer,int length);
+    int writeValue(long long dataAddress,long long offset,const char* buffer,int length);
+    int collectGarbage(int maxRecords);
+    void enableFinger(bool enable);
+    void pinUpperLevels(int levels); //pinned levels speed up lookups; insert and remove still descend through the page cache
+    void enableFilter(const char* fileName,long long bits);
+    bool filterStale();
+    long long rebuildFilter();
+    void enableCache(long long budget);
+    CacheStats cacheStats();
+    void setMergeThreshold(int threshold);
+    int rebalance(int maxFixes);
+    template<typename LookupKey,typename C=Compare,typename C::is_transparent* =nullptr>
+    bool find(const LookupKey& key,long long& dataAddress)
+    {
+        return searchLeaf(key,dataAddress)==0;
+    }
+    template<typename LookupKey,typename C=Compare,typename C::is_transparent* =nullptr>
+    bool contains(const LookupKey& key)
+    {
+        long long dataAddress=-1;
+        return searchLeaf(key,dataAddress)==0;
+    }
+    template<typename LookupKey,typename C=Compare,typename C::is_transparent* =nullptr>
+    bool tryGet(const LookupKey& key,ValueType& value)
+    {
+        long long dataAddress=-1;
+        if (searchLeaf(key,dataAddress)!=0)
+            return false;
+        value=Storage::load(dataManager,dataAddress);
+        return true;
+    }
+    template<typename LookupKey,typename C=Compare,typename C::is_transparent* =nullptr>
+    PinnedValue<ValueType> getRef(const LookupKey& key)
+    {
+        long long dataAddress=-1;
+        if (!find(key,dataAddress))
+            return PinnedValue<ValueType>();
+        return PinnedValue<ValueType>(dataManager,dataAddress);
+    }
 private:
     struct Node
     {
@@ -24,555 +509,1658 @@ private:
 	bool isLeaf;
 	long long keyAddr[BTORDER];
 	long long childAddr[BTORDER];
+	long long count[BTORDER];
+	typename Aggregate::Type partial[BTORDER];
+    };
+    struct Finger
+    {
+        long long addr;
+        int pos;
+        long long low;
+        long long high;
+        bool hasLow;
     };
     struct Record
     {
-       Node* node;
-       long long addr;
+       PageGuard<Node> guard;
        int pos;
-       Record(){};
-       Record(Node* nn,long long address,int position)
-           :node(nn),addr(address),pos(position){};
+       Record():pos(0){};
+    };
+    struct BatchScope
+    {
+        BPlusMap* tree;
+        bool fingerEnabled;
+        int threshold;
+        BatchScope(BPlusMap* owner):tree(owner),fingerEnabled(owner->useFinger),threshold(owner->mergeThreshold)
+        {
+            tree->useFinger=true;
+            tree->fingerDepth=0;
+            tree->mergeThreshold=0;
+            tree->batchNext=NULL;
+        }
+        ~BatchScope()
+        {
+            tree->useFinger=fingerEnabled;
+            tree->fingerDepth=0;
+            tree->mergeThreshold=threshold;
+            tree->batchNext=NULL;
+        }
+    };
+    struct ResidentNode
+    {
+        long long addr;
+        Node* node;
+        int child[BTORDER];
+        long long childAddr[BTORDER];
+        ResidentNode(long long address,Node* residentNode):addr(address),node(residentNode)
+        {
+            for (int i=0;i<BTORDER;i++)
+            {
+                child[i]=0;
+                childAddr[i]=-1;
+            }
+        }
+    };
+    struct EraseBatch
+    {
+        vector<long long> keys;
+        vector<long long> values;
+        vector<long long> nodes;
     };
     MemoryHandler<Node>* indexManager;
-    MemoryHandler<ValueType>* dataManager;
-    MemoryHandler<KeyType>*keyManager;
+    typename Storage::Handler* dataManager;
+    typename KeyStorage<KeyType>::Handler* keyManager;
+    Compare comparator;
+    typedef SeparatorPolicy<IsStringKey<KeyType>::value && std::is_same<Compare,KeyCompare>::value> Separator;
+    typedef typename std::conditional<std::is_same<Compare,KeyCompare>::value && HashableKey<KeyType>::value,ValueCache<KeyType,ValueType,KeyHash<KeyType>,KeyEqual>,DisabledCache<KeyType,ValueType> >::type Cache;
     long long keyBuffer[BTORDER+1];
     long long childBuffer[BTORDER+1];
+    long long countBuffer[BTORDER+1];
+    typename Aggregate::Type partialBuffer[BTORDER+1];
     Node* root;
     Node memoryNode;
+    PageGuard<Node> spine[MAXHEIGHT];
+    int spineDepth;
+    vector<ResidentNode> upperNodes;
+    int upperLevels;
+    bool upperStale;
+    Finger finger[MAXHEIGHT];
+    int fingerDepth;
+    bool useFinger;
+    const KeyType* batchNext;
+    int mergeThreshold;
+    BloomFilter* filter;
+    Cache* cache;
     BPlusMap();
+    void loadSpine();
+    void releaseSpine();
+    void loadUpper();
+    void releaseUpper();
+    template<typename LookupKey>
+    int fingerStart(const LookupKey& key);
+    void recordFinger(int level,long long address,Node* currentNode,int position);
+    int rebalanceNode(Node* currentNode,int& budget);
+    void collapseRoot(Node* rootNode);
+    void repairNode(Node* currentNode,const vector<KeyType>& keys,int first,int last);
+    int compareKey(long long keyAddress,const KeyType& key);
+    void eraseInNode(Node* currentNode,const KeyType& low,const KeyType& high,bool lowCovered,EraseBatch& batch);
+    void freeSubtree(long long address,EraseBatch& batch);
+    void filterSubtree(long long address);
+    template<typename LookupKey>
+    bool filterMiss(const LookupKey& key);
     long long addNodeInMemory();
-    int searchInNode(Node* currentNode,const KeyType& key,const int& mode);
-    int insertInNode(Node* currentNode,long long  keyAddress,long long  childAddress,const int& pos);
-    void splitNode(Node* currentNode,long long & keyAddress, long long & childAddress,int position);
-    void splitRoot(Node* currentNode,long long & keyAddress,long long & childAddress,int position);
-    void putInBuffer(Node* currentNode,long long  keyAddress,long long  childAddress, int position);
+    template<typename OnHit,typename... Args>
+    long long insertKey(const KeyType& key,OnHit onHit,Args&&... args);
+    template<typename LookupKey>
+    int searchLeaf(const LookupKey& key,long long& dataAddress);
+    template<typename LookupKey>
+    int searchLeaf(const LookupKey& key,PageGuard<Node>& leaf,int& position);
+    template<typename LookupKey>
+    int searchInNode(Node* currentNode,const LookupKey& key,int mode);
+    int insertInNode(Node* currentNode,long long  keyAddress,long long  childAddress,long long entryCount,int pos);
+    void splitNode(Node* currentNode,long long & keyAddress, long long & childAddress,long long & entryCount,int position,bool rightEdge);
+    void splitRoot(Node* currentNode,long long & keyAddress,long long & childAddress,long long entryCount,int position,bool rightEdge);
+    int splitPoint(Node* currentNode,int position,bool rightEdge);
+    void putInBuffer(Node* currentNode,long long  keyAddress,long long  childAddress,long long entryCount, int position);
+    long long subtreeCount(Node* currentNode);
+    long long countBelow(const KeyType& key,bool inclusive);
+    void aggregateInNode(Node* currentNode,const KeyType& low,const KeyType& high,bool lowCovered,typename Aggregate::Type& result);
+    typename Aggregate::Type foldNode(Node* currentNode);
+    void refreshEntry(Node* currentNode,int position);
+    void refreshPath(const KeyType& key);
+    void valueChanged(const KeyType& key);
+    void keysChanged();
     void removeInNode(Node* currentNode,int position);
-    int borrowFromSibling(Node* currentNode,long long & index,long long & keyAddress,long long & childAddress,int position);
-    int combine(Node* currentNode,long long & index,long long & keyAddress,long long & childAddress,int position);
+    int borrowFromSibling(Node* currentNode,int position,int minNum=(BTORDER+1)>>1);
+    int combine(Node* currentNode,int position);
 };
 
-template<typename KeyType,typename ValueType>
-ValueType BPlusMap<KeyType,ValueType>::get(const KeyType& key)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename LookupKey>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::searchLeaf(const LookupKey& key,long long& dataAddress)
+{
+    PageGuard<Node> leaf;
+    int position;
+    int check=searchLeaf(key,leaf,position);
+    if (check==0)
+        dataAddress=leaf->childAddr[position];
+    return check;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename LookupKey>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::searchLeaf(const LookupKey& key,PageGuard<Node>& leaf,int& position)
 {
-    long long address=PAGESIZE<<1-PAGEREST;
-    int position,addrTemp;
-    Node* currentNode=(Node*)(indexManager->getAddr(address));
-    int num=currentNode->num;
-    if (num==0)
+    if (filter && filterMiss(key))
+        return filter->live()?-1:-2;
+    int level=useFinger?fingerStart(key):0;
+    PageGuard<Node> currentNode;
+    if (!level && upperLevels)
     {
-        indexManager->unMapAddr(address);
-	throw string("BPLUSMAP EMPTY");
+        if (upperStale)
+            loadUpper();
+        ResidentNode* resident=&upperNodes[0];
+        if (resident->node->num==0)
+            return -2;
+        while (!resident->node->isLeaf)
+        {
+            Node* node=resident->node;
+            position=searchInNode(node,key,0);
+            if (useFinger)
+                recordFinger(level++,resident->addr,node,position);
+            if (position==node->num)
+                return -1;
+            if (resident->childAddr[position]!=node->childAddr[position])
+                upperStale=true;
+            if (upperStale || !resident->child[position])
+                break;
+            resident=&upperNodes[resident->child[position]];
+        }
+        if (resident->node->isLeaf)
+            currentNode=PageGuard<Node>(indexManager,resident->addr);
+        else
+            currentNode=PageGuard<Node>(indexManager,resident->node->childAddr[position]);
     }
-    while (true)
+    else
     {
-        if (currentNode->isLeaf)
-            position=searchInNode(currentNode,key,2);
-	else 
-	    position=searchInNode(currentNode,key,0);
-	if (currentNode->isLeaf)
-	{
-	    if (position==-1)
-            {
-	        indexManager->unMapAddr(address);
-	        throw string("BPLUSMAP QUERY ERROR: KEY NOT FOUND!");
-	    }
-	    else
-	    {
-	        indexManager->unMapAddr(address);
-	        return dataManager->getValue(currentNode->childAddr[position]);
-	    }
-	}
-	addrTemp=address;
-	if (currentNode->num==position)
-            address=currentNode->childAddr[position-1];
-	else 
-	    address=currentNode->childAddr[position];
-	indexManager->unMapAddr(addrTemp);
-	currentNode=(Node*)(indexManager->getAddr(address));
+        currentNode=PageGuard<Node>(indexManager,level?finger[level].addr:ROOTADDR);
+        if (currentNode->num==0)
+            return -2;
+    }
+    while (!currentNode->isLeaf)
+    {
+        position=searchInNode(currentNode.get(),key,0);
+        if (useFinger)
+            recordFinger(level++,currentNode.address(),currentNode.get(),position);
+        if (position==currentNode->num)
+            return -1;
+        currentNode=PageGuard<Node>(indexManager,currentNode->childAddr[position]);
     }
+    position=searchInNode(currentNode.get(),key,2);
+    if (useFinger)
+        recordFinger(level,currentNode.address(),currentNode.get(),position);
+    if (position==-1)
+        return -1;
+    leaf=std::move(currentNode);
+    return 0;
 }
 
-template<typename KeyType,typename ValueType>
-int BPlusMap<KeyType,ValueType>::update(const KeyType& key,const ValueType& value)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+ValueType BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::get(const KeyType& key)
 {
-    long long address=PAGESIZE<<1-PAGEREST;
-    int position,addrTemp;
-    ValueType valueTemp=value;
-    Node* currentNode=(Node*)(indexManager->getAddr(address));
-    int num=currentNode->num;
-    if (num==0)
+    if (cache)
     {
-        indexManager->unMapAddr(address);
-	throw string("BPLUSMAP EMPTY");
+        ValueType value;
+        if (cache->get(key,value))
+            return value;
     }
-    while (true)
+    long long dataAddress=-1;
+    int check=searchLeaf(key,dataAddress);
+    if (check==-2)
+        throw string("BPLUSMAP EMPTY");
+    if (check==-1)
+        throw string("BPLUSMAP QUERY ERROR: KEY NOT FOUND!");
+    ValueType value=Storage::load(dataManager,dataAddress);
+    if (cache)
+        cache->admit(key,value);
+    return value;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::update(const KeyType& key,const ValueType& value)
+{
+    PageGuard<Node> leaf;
+    int position;
+    int check=searchLeaf(key,leaf,position);
+    if (check==-2)
+        throw string("BPLUSMAP EMPTY");
+    if (check==-1)
+        throw string("BPLUSMAP UPDATE ERROR: KEY NOT FOUND!");
+    leaf->childAddr[position]=Storage::update(dataManager,leaf->childAddr[position],value);
+    valueChanged(key);
+    return 0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::find(const KeyType& key,long long& dataAddress)
+{
+    return searchLeaf(key,dataAddress)==0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::contains(const KeyType& key)
+{
+    long long dataAddress=-1;
+    return searchLeaf(key,dataAddress)==0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::tryGet(const KeyType& key,ValueType& value)
+{
+    if (cache && cache->get(key,value))
+        return true;
+    long long dataAddress=-1;
+    if (searchLeaf(key,dataAddress)!=0)
+        return false;
+    value=Storage::load(dataManager,dataAddress);
+    if (cache)
+        cache->admit(key,value);
+    return true;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::tryUpdate(const KeyType& key,const ValueType& value)
+{
+    PageGuard<Node> leaf;
+    int position;
+    if (searchLeaf(key,leaf,position)!=0)
+        return -1;
+    leaf->childAddr[position]=Storage::update(dataManager,leaf->childAddr[position],value);
+    valueChanged(key);
+    return 0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::insertOrAssign(const KeyType& key,const ValueType& value)
+{
+    bool assigned=false;
+    insertKey(key,[&](long long& dataAddress)->bool
     {
-        if (currentNode->isLeaf)
-            position=searchInNode(currentNode,key,2);
-	else 
-	    position=searchInNode(currentNode,key,0);
-	if (currentNode->isLeaf)
-	{
-	    if (position==-1)
+        assigned=true;
+        dataAddress=Storage::update(dataManager,dataAddress,value);
+        return true;
+    },value);
+    return assigned?0:1;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename Modifier>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::upsert(const KeyType& key,const ValueType& value,Modifier modifier)
+{
+    bool modified=false;
+    insertKey(key,[&](long long& dataAddress)->bool
+    {
+        modified=true;
+        dataAddress=Storage::modify(dataManager,dataAddress,modifier);
+        return true;
+    },value);
+    return modified?0:1;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename Modifier>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::modify(const KeyType& key,Modifier modifier)
+{
+    PageGuard<Node> leaf;
+    int position;
+    if (searchLeaf(key,leaf,position)!=0)
+        return -1;
+    leaf->childAddr[position]=Storage::modify(dataManager,leaf->childAddr[position],modifier);
+    valueChanged(key);
+    return 0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+PinnedValue<ValueType> BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::getRef(const KeyType& key)
+{
+    long long dataAddress=-1;
+    if (!find(key,dataAddress))
+        return PinnedValue<ValueType>();
+    return PinnedValue<ValueType>(dataManager,dataAddress);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename Visitor>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::visit(const KeyType& key,Visitor visitor)
+{
+    PinnedValue<ValueType> value=getRef(key);
+    if (!value.valid())
+        return false;
+    visitor(*value);
+    return true;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::reserveValue(const KeyType& key,long long length)
+{
+    const ReservedValue reserved(length);
+    return insertKey(key,KeepExisting(),reserved);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::valueLength(long long dataAddress)
+{
+    return dataManager->getLength(dataAddress);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::readValue(long long dataAddress,long long offset,char* buffer,int length)
+{
+    return dataManager->read(dataAddress,offset,buffer,length);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::writeValue(long long dataAddress,long long offset,const char* buffer,int length)
+{
+    if (cache)
+        cache->clear();
+    return dataManager->write(dataAddress,offset,buffer,length);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::collectGarbage(int maxRecords)
+{
+    int moved=0;
+    long long addr=dataManager->getTail();
+    long long head=dataManager->getHead();
+    for (int i=0;i<maxRecords && addr<head;i++)
+    {
+        if (dataManager->isLive(addr))
+        {
+            long long keyAddress=dataManager->getKeyAddr(addr);
+            typename KeyStorage<KeyType>::Guard storedKey(keyManager,keyAddress);
+            PageGuard<Node> leaf;
+            int position;
+            if (searchLeaf(*storedKey,leaf,position)==0 && leaf->childAddr[position]==addr)
             {
-	        indexManager->unMapAddr(address);
-	        throw string("BPLUSMAP UPDATE ERROR: KEY NOT FOUND!");
-	    }
-	    else
-	    {
-	        indexManager->unMapAddr(address);
-	        dataManager->update(currentNode->childAddr[position],&valueTemp);
-		return 0;
-	    }
-	}
-	addrTemp=address;
-	if (currentNode->num==position)
-            address=currentNode->childAddr[position-1];
-	else 
-	    address=currentNode->childAddr[position];
-	indexManager->unMapAddr(addrTemp);
-	currentNode=(Node*)(indexManager->getAddr(address));
+                ValueType value=dataManager->getValue(addr);
+                leaf->childAddr[position]=dataManager->append(keyAddress,&value);
+                moved++;
+            }
+        }
+        addr=dataManager->next(addr);
     }
-    return -1;
+    dataManager->truncate(addr);
+    return moved;
 }
 
-template<typename KeyType,typename ValueType>
-BPlusMap<KeyType,ValueType>::BPlusMap(const char* indexFileName,const char* keyFileName,const char* dataFileName)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::BPlusMap(const char* indexFileName,const char* keyFileName,const char* dataFileName,const Compare& compare)
+    :comparator(compare)
 {
     indexManager=new MemoryHandler<Node>(indexFileName);
-    keyManager=new MemoryHandler<KeyType>(keyFileName);
-    dataManager=new MemoryHandler<ValueType>(dataFileName);
+    keyManager=new typename KeyStorage<KeyType>::Handler(keyFileName);
+    dataManager=new typename Storage::Handler(dataFileName);
     memoryNode.num=0;
     memoryNode.isLeaf=true;
     memset(memoryNode.keyAddr, 0, sizeof(long long) * (BTORDER));
     memset(memoryNode.childAddr, 0, sizeof(long long) * BTORDER);
+    memset(memoryNode.count, 0, sizeof(long long) * BTORDER);
+    for (int i=0;i<BTORDER;i++)
+        memoryNode.partial[i]=Aggregate::identity();
+    spineDepth=0;
+    upperLevels=0;
+    upperStale=true;
+    fingerDepth=0;
+    useFinger=false;
+    batchNext=NULL;
+    filter=NULL;
+    cache=NULL;
+    mergeThreshold=(BTORDER+1)>>1;
     if (indexManager->getTotal()==1)
         addNodeInMemory();
 }
 
-template<typename KeyType,typename ValueType>
-BPlusMap<KeyType,ValueType>::~BPlusMap()
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::~BPlusMap()
+{
+    releaseSpine();
+    releaseUpper();
+    delete indexManager;
+    delete keyManager;
+    delete dataManager;
+    delete filter;
+    delete cache;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::addNodeInMemory()
+{
+    return indexManager->insert(&memoryNode);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::loadSpine()
+{
+    spine[0]=PageGuard<Node>(indexManager,ROOTADDR);
+    spineDepth=1;
+    while (!spine[spineDepth-1]->isLeaf && spine[spineDepth-1]->num)
+    {
+        Node* node=spine[spineDepth-1].get();
+        spine[spineDepth]=PageGuard<Node>(indexManager,node->childAddr[node->num-1]);
+        spineDepth++;
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::enableFinger(bool enable)
+{
+    useFinger=enable;
+    fingerDepth=0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename LookupKey>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::fingerStart(const LookupKey& key)
+{
+    for (int level=fingerDepth-1;level>0;level--)
+    {
+        {
+            typename KeyStorage<KeyType>::Guard high(keyManager,Separator::address(finger[level].high));
+            if (comparator(*high,key)<0)
+                continue;
+        }
+        if (finger[level].hasLow)
+        {
+            typename KeyStorage<KeyType>::Guard low(keyManager,Separator::address(finger[level].low));
+            if (comparator(*low,key)>=0)
+                continue;
+        }
+        return level;
+    }
+    return 0;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::recordFinger(int level,long long address,Node* currentNode,int position)
+{
+    if (!level)
+        finger[0].hasLow=false;
+    finger[level].addr=address;
+    finger[level].pos=position;
+    fingerDepth=level+1;
+    if (currentNode->isLeaf || position>=currentNode->num)
+        return;
+    finger[level+1].hasLow=position>0 || finger[level].hasLow;
+    finger[level+1].low=position>0?currentNode->keyAddr[position-1]:finger[level].low;
+    finger[level+1].high=currentNode->keyAddr[position];
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::releaseSpine()
+{
+    while (spineDepth)
+        spine[--spineDepth].release();
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::pinUpperLevels(int levels)
+{
+    releaseUpper();
+    upperLevels=levels<0?0:(levels>MAXHEIGHT?MAXHEIGHT:levels);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::loadUpper()
+{
+    vector<ResidentNode> nodes;
+    nodes.push_back(ResidentNode(ROOTADDR,static_cast<Node*>(indexManager->getAddr(ROOTADDR))));
+    int levelStart=0;
+    for (int level=0;level<upperLevels && levelStart<(int)nodes.size();level++)
+    {
+        int levelEnd=(int)nodes.size();
+        for (int i=levelStart;i<levelEnd;i++)
+        {
+            Node* node=nodes[i].node;
+            for (int j=0;!node->isLeaf && j<node->num;j++)
+            {
+                nodes[i].childAddr[j]=node->childAddr[j];
+                if (level+1==upperLevels)
+                    continue;
+                nodes[i].child[j]=(int)nodes.size();
+                nodes.push_back(ResidentNode(node->childAddr[j],static_cast<Node*>(indexManager->getAddr(node->childAddr[j]))));
+            }
+        }
+        levelStart=levelEnd;
+    }
+    upperNodes.swap(nodes);
+    for (size_t i=0;i<nodes.size();i++)
+        indexManager->unMapAddr(nodes[i].addr);
+    upperStale=false;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::releaseUpper()
+{
+    for (size_t i=0;i<upperNodes.size();i++)
+        indexManager->unMapAddr(upperNodes[i].addr);
+    upperNodes.clear();
+    upperStale=true;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::enableFilter(const char* fileName,long long bits)
+{
+    if (!std::is_same<Compare,KeyCompare>::value)
+        throw string("BPLUSMAP FILTER ERROR: CUSTOM COMPARATOR NOT SUPPORTED!");
+    if (!HashableKey<KeyType>::value)
+        throw string("BPLUSMAP FILTER ERROR: KEY TYPE NOT HASHABLE!");
+    delete filter;
+    filter=NULL;
+    filter=new BloomFilter(fileName,bits);
+    if (filter->fresh() || filter->getStamp()!=indexManager->getStamp() || filter->live()!=size())
+        rebuildFilter();
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::filterStale()
+{
+    return filter && filter->stale();
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::rebuildFilter()
+{
+    if (!filter)
+        return 0;
+    long long total=size();
+    long long bits=total*FILTERBITSPERKEY*2;
+    filter->reset(bits>filter->getBits()?bits:filter->getBits());
+    filterSubtree(ROOTADDR);
+    filter->setStamp(indexManager->getStamp());
+    return total;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::enableCache(long long budget)
+{
+    if (!std::is_same<Compare,KeyCompare>::value)
+        throw string("BPLUSMAP CACHE ERROR: CUSTOM COMPARATOR NOT SUPPORTED!");
+    if (!HashableKey<KeyType>::value)
+        throw string("BPLUSMAP CACHE ERROR: KEY TYPE NOT HASHABLE!");
+    delete cache;
+    cache=NULL;
+    if (budget>0)
+        cache=new Cache(budget);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+CacheStats BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::cacheStats()
 {
-    delete indexManager;
-    delete keyManager;
-    delete dataManager;
+    if (!cache)
+        return CacheStats();
+    return cache->getStats();
 }
 
-template<typename KeyType,typename ValueType>
-long long BPlusMap<KeyType,ValueType>::addNodeInMemory()
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::filterSubtree(long long address)
 {
-    return indexManager->insert(&memoryNode);
+    PageGuard<Node> currentNode(indexManager,address);
+    for (int i=0;i<currentNode->num;i++)
+    {
+        if (!currentNode->isLeaf)
+        {
+            filterSubtree(currentNode->childAddr[i]);
+            continue;
+        }
+        typename KeyStorage<KeyType>::Guard storedKey(keyManager,currentNode->keyAddr[i]);
+        filter->add(KeyHash<KeyType>::hash(*storedKey));
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename LookupKey>
+bool BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::filterMiss(const LookupKey& key)
+{
+    if (!std::is_same<LookupKey,KeyType>::value && !(IsStringKey<LookupKey>::value && IsStringKey<KeyType>::value))
+        return false;
+    return !filter->mayContain(KeyHash<LookupKey>::hash(key));
 }
 
-template<typename KeyType,typename ValueType>
-int BPlusMap<KeyType,ValueType>::searchInNode(Node* currentNode,const KeyType& key,const int& mode)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename LookupKey>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::searchInNode(Node* currentNode,const LookupKey& key,int mode)
 {
     int left=0;
     int right=currentNode->num;
     while (left<right)
     {
         int mid=(left+right)>>1;
-	int check=keyManager->compare(currentNode->keyAddr[mid],key);
+	typename KeyStorage<KeyType>::Guard storedKey(keyManager,Separator::address(currentNode->keyAddr[mid]));
+	int check=comparator(*storedKey,key);
 	if (check==0)
 	{
 	    if (mode==1) return -1;
 	    return mid;
 	}
-	if (check==-1) left=mid+1;
+	if (check<0) left=mid+1;
 	else right=mid;
     }
     if (mode==2) return -1;
     else return left;
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::putInBuffer(Node* currentNode,long long  keyAddress,long long  childAddress, int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::putInBuffer(Node* currentNode,long long  keyAddress,long long  childAddress,long long entryCount, int position)
 {
     for(int i=0; i<position; i++){
         keyBuffer[i] = currentNode->keyAddr[i];
         childBuffer[i] = currentNode->childAddr[i];
+        countBuffer[i] = currentNode->count[i];
+        partialBuffer[i] = currentNode->partial[i];
     }
     keyBuffer[position] =  keyAddress;
     childBuffer[position] = childAddress;
+    countBuffer[position] = entryCount;
+    partialBuffer[position] = Aggregate::identity();
     for(int i=position; i<currentNode->num; i++){
         keyBuffer[i+1] = currentNode->keyAddr[i];
         childBuffer[i+1] = currentNode->childAddr[i];
+        countBuffer[i+1] = currentNode->count[i];
+        partialBuffer[i+1] = currentNode->partial[i];
     }
 }
 
 
-template<typename KeyType,typename ValueType>
-int BPlusMap<KeyType,ValueType>::insertInNode(Node* currentNode,long long  keyAddress,long long  childAddress,const int& pos)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::insertInNode(Node* currentNode,long long  keyAddress,long long  childAddress,long long entryCount,int pos)
 {
     for(int i=currentNode->num-1; i>=pos; i--)
     {
         currentNode->keyAddr[i+1] = currentNode->keyAddr[i];
         currentNode->childAddr[i+1] = currentNode->childAddr[i];
+        currentNode->count[i+1] = currentNode->count[i];
+        currentNode->partial[i+1] = currentNode->partial[i];
     }
     currentNode->num++;
     currentNode->keyAddr[pos] = keyAddress;
     currentNode->childAddr[pos] = childAddress;
+    currentNode->count[pos] = entryCount;
+    currentNode->partial[pos] = Aggregate::identity();
     return 0;
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::insert(const KeyType& key,const ValueType& value)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::insert(const KeyType& key,const ValueType& value)
 {
-    int position;
-    bool isMax=false;
-    long long keyAddress,childAddress,keyAddressTemp;
-    KeyType keyTemp=key;
-    ValueType valueTemp=value;
-    int address=(PAGESIZE<<1)-PAGEREST;
-    stack<Record>record;
-    Node* currentNode=(Node*)(indexManager->getAddr(address));
-    while (true)
+    insertKey(key,KeepExisting(),value);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::insert(KeyType&& key,ValueType&& value)
+{
+    insertKey(key,KeepExisting(),std::move(value));
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename... Args>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::emplace(const KeyType& key,Args&&... args)
+{
+    insertKey(key,KeepExisting(),std::forward<Args>(args)...);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+template<typename OnHit,typename... Args>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::insertKey(const KeyType& key,OnHit onHit,Args&&... args)
+{
+    int position,depth=0,maxDepth=0;
+    bool isMax=false,isSplit=false,rightEdge=true;
+    long long keyAddress,childAddress,dataAddress,keyAddressTemp,leftKeyAddress=0;
+    long long entryCount=1,leftCount=0;
+    PageGuard<Node> rootNode;
+    if (!spineDepth)
     {
-        position=searchInNode(currentNode,key,1);
-	if (position==-1) 
-	{
-	    while (record.size()) 
-	    {
-	        indexManager->unMapAddr(record.top().addr);
-	        record.pop();
+        rootNode=PageGuard<Node>(indexManager,ROOTADDR);
+        if (rootNode->num>0)
+        {
+            typename KeyStorage<KeyType>::Guard maxKey(keyManager,Separator::address(rootNode->keyAddr[rootNode->num-1]));
+            if (comparator(*maxKey,key)<0)
+                loadSpine();
+        }
+    }
+    if (spineDepth)
+    {
+        Node* leaf=spine[spineDepth-1].get();
+        bool append=false;
+        if (leaf->num>0 && leaf->num<BTORDER)
+        {
+            typename KeyStorage<KeyType>::Guard maxKey(keyManager,leaf->keyAddr[leaf->num-1]);
+            append=comparator(*maxKey,key)<0;
+        }
+        if (append)
+        {
+            keyAddress=keyManager->insert(&key);
+            if (filter)
+                filter->add(KeyHash<KeyType>::hash(key));
+            keysChanged();
+            dataAddress=Storage::store(dataManager,keyAddress,std::forward<Args>(args)...);
+            leaf->keyAddr[leaf->num]=keyAddress;
+            leaf->childAddr[leaf->num]=dataAddress;
+            leaf->count[leaf->num]=1;
+            leaf->num++;
+            if (Aggregate::enabled)
+                refreshEntry(leaf,leaf->num-1);
+            for (int i=spineDepth-2;i>=0;i--)
+            {
+                Node* node=spine[i].get();
+                Separator::drop(keyManager,node->keyAddr[node->num-1]);
+                node->keyAddr[node->num-1]=keyAddress;
+                node->count[node->num-1]++;
+                if (Aggregate::enabled)
+                    node->partial[node->num-1]=foldNode(spine[i+1].get());
             }
-	    return;
-	}
-	record.push(Record(currentNode,address,position));
-	if (currentNode->isLeaf)
+            fingerDepth=0;
+            return dataAddress;
+        }
+    }
+    releaseSpine();
+    Record record[MAXHEIGHT];
+    int level=useFinger?fingerStart(key):0;
+    for (;depth<level;depth++)
+    {
+        record[depth].guard=PageGuard<Node>(indexManager,finger[depth].addr);
+        record[depth].pos=finger[depth].pos;
+        rightEdge=false;
+    }
+    PageGuard<Node> currentNode(indexManager,level?finger[level].addr:ROOTADDR);
+    rootNode.release();
+    while (true)
+    {
+        position=searchInNode(currentNode.get(),key,currentNode->isLeaf?1:0);
+        if (position==-1)
+        {
+            if (onHit(currentNode->childAddr[searchInNode(currentNode.get(),key,2)]))
+                valueChanged(key);
+            return -1;
+        }
+        if (useFinger)
+            recordFinger(depth,currentNode.address(),currentNode.get(),position);
+        if (position!=currentNode->num)
+            rightEdge=false;
+        if (currentNode->isLeaf)
         {
-            if (position==currentNode->num) isMax=true;
+            if (isMax || currentNode->num==BTORDER)
+                fingerDepth=0;
+            for (int i=0;i<depth;i++)
+                record[i].guard->count[record[i].pos]++;
+            record[depth].guard=std::move(currentNode);
+            record[depth++].pos=position;
             break;
         }
-	if (currentNode->num==position) address=currentNode->childAddr[position-1];
-	else address=currentNode->childAddr[position];
-	currentNode=(Node*)(indexManager->getAddr(currentNode->childAddr[position]));
+        if (currentNode->num==position)
+        {
+            if (!isMax) maxDepth=depth;
+            isMax=true;
+            position--;
+        }
+        long long address=currentNode->childAddr[position];
+        record[depth].guard=std::move(currentNode);
+        record[depth++].pos=position;
+        currentNode=PageGuard<Node>(indexManager,address);
     }
-    keyAddress=keyManager->insert(&keyTemp);
-    childAddress=dataManager->insert(&valueTemp);
+    keyAddress=keyManager->insert(&key);
+    if (filter)
+        filter->add(KeyHash<KeyType>::hash(key));
+    keysChanged();
+    childAddress=Storage::store(dataManager,keyAddress,std::forward<Args>(args)...);
+    dataAddress=childAddress;
     keyAddressTemp=keyAddress;
-    while (record.size())
-    {
-        position=record.top().pos;
-	address=record.top().addr;
-	currentNode=record.top().node;
-	record.pop();
-	if (isMax) currentNode->keyAddr[position]=keyAddressTemp;
-	if (currentNode->num!=BTORDER)
-	{
-	    insertInNode(currentNode,keyAddress,childAddress,position);
-	    indexManager->unMapAddr(address);
-	    break;
-	}
-	else if (record.size())
-	{
-	    splitNode(currentNode,keyAddress,childAddress,position);
-	}
-	else 
-	{
-	    splitRoot(currentNode,keyAddress,childAddress,position);
-	}
-    }
-    while (record.size())
+    while (depth)
     {
-        if (isMax) record.top().node->keyAddr[record.top().pos]=keyAddressTemp;
-        indexManager->unMapAddr(record.top().addr);
-	record.pop();
+        Node* node=record[depth-1].guard.get();
+        position=record[depth-1].pos;
+        if (!node->isLeaf)
+        {
+            isMax=isMax && depth>maxDepth;
+            if (isMax)
+            {
+                Separator::drop(keyManager,node->keyAddr[position]);
+                node->keyAddr[position]=keyAddressTemp;
+            }
+            if (!isSplit)
+            {
+                if (Aggregate::enabled)
+                    refreshEntry(node,position);
+                if (!isMax && !Aggregate::enabled) break;
+                record[--depth].guard.release();
+                continue;
+            }
+            keyAddress=node->keyAddr[position];
+            node->keyAddr[position]=leftKeyAddress;
+            entryCount=node->count[position]-leftCount;
+            node->count[position]=leftCount;
+            position++;
+        }
+        if (node->num!=BTORDER)
+        {
+            insertInNode(node,keyAddress,childAddress,entryCount,position);
+            if (Aggregate::enabled)
+            {
+                refreshEntry(node,position);
+                if (!node->isLeaf)
+                    refreshEntry(node,position-1);
+            }
+            isSplit=false;
+        }
+        else if (depth>1)
+        {
+            splitNode(node,keyAddress,childAddress,entryCount,position,rightEdge);
+            leftKeyAddress=keyAddress;
+            leftCount=entryCount;
+            isSplit=true;
+        }
+        else
+        {
+            splitRoot(node,keyAddress,childAddress,entryCount,position,rightEdge);
+            isSplit=false;
+        }
+        record[--depth].guard.release();
     }
+    return dataAddress;
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::splitNode(Node* currentNode,long long & keyAddress,long long & childAddress,int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::splitNode(Node* currentNode,long long & keyAddress,long long & childAddress,long long & entryCount,int position,bool rightEdge)
 {
     long long sibling=addNodeInMemory();
-    Node* sib=(Node*)(indexManager->getAddr(sibling));
-    putInBuffer(currentNode,keyAddress,childAddress,position);
-    currentNode->num=BTORDER>>1;
-    sib->num=BTORDER-currentNode->num;
+    PageGuard<Node> sib(indexManager,sibling);
+    putInBuffer(currentNode,keyAddress,childAddress,entryCount,position);
+    currentNode->num=splitPoint(currentNode,position,rightEdge);
+    sib->num=BTORDER+1-currentNode->num;
     sib->isLeaf=currentNode->isLeaf;
     for (int i=0;i<currentNode->num;i++)
     {
         currentNode->keyAddr[i]=keyBuffer[i];
 	currentNode->childAddr[i]=childBuffer[i];
+	currentNode->count[i]=countBuffer[i];
+	currentNode->partial[i]=partialBuffer[i];
     }
     for (int i=currentNode->num;i<BTORDER+1;i++)
     {
         sib->keyAddr[i-currentNode->num]=keyBuffer[i];
 	sib->childAddr[i-currentNode->num]=childBuffer[i];
+	sib->count[i-currentNode->num]=countBuffer[i];
+	sib->partial[i-currentNode->num]=partialBuffer[i];
     }
-    keyAddress=currentNode->keyAddr[currentNode->num-1];
+    for (int i=currentNode->isLeaf?position:position-1;Aggregate::enabled && i<=position;i++)
+    {
+        if (i<currentNode->num)
+            refreshEntry(currentNode,i);
+        else
+            refreshEntry(sib.get(),i-currentNode->num);
+    }
+    entryCount=subtreeCount(currentNode);
+    if (currentNode->isLeaf)
+        keyAddress=Separator::make(keyManager,currentNode->keyAddr[currentNode->num-1],sib->keyAddr[0]);
+    else
+        keyAddress=Separator::copy(keyManager,currentNode->keyAddr[currentNode->num-1]);
     childAddress=sibling;
-    indexManager->unMapAddr(sibling);
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::splitRoot(Node* currentNode,long long & keyAddress,long long & childAddress,int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::splitRoot(Node* currentNode,long long & keyAddress,long long & childAddress,long long entryCount,int position,bool rightEdge)
 {
     long long leftAddress,rightAddress;
     leftAddress=addNodeInMemory();
     rightAddress=addNodeInMemory();
-    Node* left=(Node*)(indexManager->getAddr(leftAddress));
-    Node* right=(Node*)(indexManager->getAddr(rightAddress));
-    putInBuffer(currentNode,keyAddress,childAddress,position);
-    left->num=BTORDER>>1;
-    right->num=BTORDER-left->num;
+    PageGuard<Node> left(indexManager,leftAddress);
+    PageGuard<Node> right(indexManager,rightAddress);
+    putInBuffer(currentNode,keyAddress,childAddress,entryCount,position);
+    left->num=splitPoint(currentNode,position,rightEdge);
+    right->num=BTORDER+1-left->num;
     left->isLeaf=currentNode->isLeaf;
     right->isLeaf=currentNode->isLeaf;
     for (int i=0;i<left->num;i++)
     {
         left->keyAddr[i]=keyBuffer[i];
 	left->childAddr[i]=childBuffer[i];
+	left->count[i]=countBuffer[i];
+	left->partial[i]=partialBuffer[i];
     }
     for (int i=left->num;i<=BTORDER;i++)
     {
         right->keyAddr[i-left->num]=keyBuffer[i];
 	right->childAddr[i-left->num]=childBuffer[i];
+	right->count[i-left->num]=countBuffer[i];
+	right->partial[i-left->num]=partialBuffer[i];
+    }
+    for (int i=left->isLeaf?position:position-1;Aggregate::enabled && i<=position;i++)
+    {
+        if (i<left->num)
+            refreshEntry(left.get(),i);
+        else
+            refreshEntry(right.get(),i-left->num);
     }
     currentNode->num=2;
-    currentNode->keyAddr[0]=left->keyAddr[left->num-1];
-    currentNode->keyAddr[1]=right->keyAddr[right->num-1];
+    if (left->isLeaf)
+        currentNode->keyAddr[0]=Separator::make(keyManager,left->keyAddr[left->num-1],right->keyAddr[0]);
+    else
+        currentNode->keyAddr[0]=Separator::copy(keyManager,left->keyAddr[left->num-1]);
+    currentNode->keyAddr[1]=Separator::copy(keyManager,right->keyAddr[right->num-1]);
     currentNode->childAddr[0]=leftAddress;
     currentNode->childAddr[1]=rightAddress;
+    currentNode->count[0]=subtreeCount(left.get());
+    currentNode->count[1]=subtreeCount(right.get());
+    currentNode->partial[0]=foldNode(left.get());
+    currentNode->partial[1]=foldNode(right.get());
     currentNode->isLeaf=false;
-    indexManager->unMapAddr(leftAddress);
-    indexManager->unMapAddr(rightAddress);
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::removeInNode(Node* currentNode,int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::splitPoint(Node* currentNode,int position,bool rightEdge)
+{
+    int half=(BTORDER+1)>>1;
+    if (rightEdge)
+        return BTORDER;
+    if (!batchNext || !currentNode->isLeaf || position<half || compareKey(keyBuffer[BTORDER],*batchNext)<0)
+        return half;
+    return position<BTORDER?position+1:BTORDER;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::removeInNode(Node* currentNode,int position)
 {
     for (int i=position;i<currentNode->num-1;i++)
     {
         currentNode->keyAddr[i]=currentNode->keyAddr[i+1];
 	currentNode->childAddr[i]=currentNode->childAddr[i+1];
+	currentNode->count[i]=currentNode->count[i+1];
+	currentNode->partial[i]=currentNode->partial[i+1];
     }
     currentNode->num--;
 }
 
-template<typename KeyType,typename ValueType>
-void BPlusMap<KeyType,ValueType>::remove(const KeyType& key)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::remove(const KeyType& key)
 {
-    KeyType keyTemp=key;
-    long long address,keyAddressTemp=0;
-    long long keyAddress,childAddress,indexTemp;
-    int position;
+    long long keyAddress,childAddress,keyAddressTemp=0;
+    int position,depth=0;
     bool isMax=false;
     bool halfEmpty=false;
-    address=PAGESIZE<<1-PAGEREST;
-    stack<Record>record;
-    Node* currentNode=(Node*)(indexManager->getAddr(address));
+    bool emptied=false;
+    Record record[MAXHEIGHT];
+    releaseSpine();
+    fingerDepth=0;
+    PageGuard<Node> currentNode(indexManager,ROOTADDR);
     while (true)
     {
     	if (currentNode->isLeaf)
-            position=searchInNode(currentNode,key,2);
+            position=searchInNode(currentNode.get(),key,2);
 	else
-	    position=searchInNode(currentNode,key,0);
-	if (position==-1) 
 	{
-	    while (record.size()) 
-	    {
-	        indexManager->unMapAddr(record.top().addr);
-	        record.pop();
-            }
-	    return;
+	    position=searchInNode(currentNode.get(),key,0);
+	    if (position==currentNode->num) position=-1;
 	}
-	record.push(Record(currentNode,address,position));
+	if (position==-1)
+	    return;
 	if (currentNode->isLeaf)
 	{
-	    if (position==currentNode->num-1)
-	        isMax=true;
-	    removeInNode(currentNode,position);
+	    record[depth].guard=std::move(currentNode);
+	    record[depth++].pos=position;
 	    break;
 	}
-	address=currentNode->childAddr[position];
-	currentNode=(Node*)(indexManager->getAddr(address));
-    }
-    keyManager->remove(currentNode->keyAddr[position]);
-    dataManager->remove(currentNode->childAddr[position]);
-    if (currentNode->num>1) keyAddressTemp=currentNode->keyAddr[currentNode->num-1];
-    while (record.size())
-    {
-        currentNode=record.top().node;
-	address=record.top().addr;
-	position=record.top().pos;
-	if (isMax) currentNode->keyAddr[position]=keyAddressTemp;
-	if (halfEmpty)
+	long long address=currentNode->childAddr[position];
+	record[depth].guard=std::move(currentNode);
+	record[depth++].pos=position;
+	currentNode=PageGuard<Node>(indexManager,address);
+    }
+    for (int i=0;i<depth-1;i++)
+        record[i].guard->count[record[i].pos]--;
+    Node* node=record[depth-1].guard.get();
+    keyAddress=node->keyAddr[position];
+    childAddress=node->childAddr[position];
+    isMax=position==node->num-1;
+    removeInNode(node,position);
+    emptied=node->num==0 && depth>1;
+    if (node->num==0) isMax=false;
+    else keyAddressTemp=node->keyAddr[node->num-1];
+    halfEmpty=node->num < mergeThreshold;
+    record[--depth].guard.release();
+    while (depth)
+    {
+        node=record[depth-1].guard.get();
+	position=record[depth-1].pos;
+	if (emptied)
+	{
+	    indexManager->remove(node->childAddr[position]);
+	    Separator::drop(keyManager,node->keyAddr[position]);
+	    removeInNode(node,position);
+	    isMax=node->num && position==node->num;
+	    emptied=node->num==0 && depth>1;
+	    if (node->num) keyAddressTemp=node->keyAddr[node->num-1];
+	    else if (depth==1) node->isLeaf=true;
+	}
+	else
 	{
-	    int check=borrowFromSibling(currentNode,indexTemp,keyAddress,childAddress,position);
-	    if (check==-1)
-	    {
-	        int flag=combine(currentNode,indexTemp,keyAddress,childAddress,position);
-		if (flag==-1)
-		{
-		    break;
-		}
-		else if (flag==1)
-		{
-		    currentNode->keyAddr[position-1]=indexTemp;
-		    removeInNode(currentNode,position);
-		}
-		else
-		{
-		    currentNode->keyAddr[position]=indexTemp;
-		    removeInNode(currentNode,position+1);
-		}
-	    }
-	    else if (check==1)
+	    if (isMax)
 	    {
-	        currentNode->keyAddr[position-1]=indexTemp;
-	        Node* child=(Node*)(indexManager->getAddr(currentNode->childAddr[position]));
-	        insertInNode(child,keyAddress,childAddress,0);
-		indexManager->unMapAddr(currentNode->childAddr[position]);
+	        if (node->keyAddr[position]==keyAddress)
+	            node->keyAddr[position]=Separator::copy(keyManager,keyAddressTemp);
+	        isMax=position==node->num-1;
 	    }
-	    else 
+	    if (Aggregate::enabled)
+	        refreshEntry(node,position);
+	    if (halfEmpty && borrowFromSibling(node,position)==-1)
+	        combine(node,position);
+	}
+	if (depth==1 && !node->isLeaf && node->num==1)
+	{
+	    long long onlyChild=node->childAddr[0];
 	    {
-	        currentNode->keyAddr[position]=indexTemp;
-		Node* child=(Node*)(indexManager->getAddr(currentNode->childAddr[position]));
-	        insertInNode(child,keyAddress,childAddress,child->num-1);
-		indexManager->unMapAddr(currentNode->childAddr[position]);
+	        PageGuard<Node> child(indexManager,onlyChild);
+	        *node=*child;
 	    }
+	    indexManager->remove(onlyChild);
 	}
-	halfEmpty=currentNode->num < ((BTORDER+1)>>1);
-	indexManager->unMapAddr(address);
-	record.pop();
+	halfEmpty=node->num < mergeThreshold;
+	if (!halfEmpty && !isMax && !emptied && !Aggregate::enabled)
+	    break;
+	record[--depth].guard.release();
     }
+    keyManager->remove(keyAddress);
+    Storage::release(dataManager,childAddress);
+    if (filter)
+        filter->erased(1);
+    keysChanged();
+    if (cache)
+        cache->erase(key);
 }
 
-template<typename KeyType,typename ValueType>
-int BPlusMap<KeyType,ValueType>::
-borrowFromSibling(Node* currentNode,long long & index,long long & keyAddress,long long & childAddress,int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::eraseRange(const KeyType& low,const KeyType& high)
 {
-    long long currentAddress;
-    int leftNum,rightNum;
-    Node* left=NULL,*right=NULL;
-    if (currentNode->num-1<(BTORDER+1)>>1)
+    if (comparator(low,high)>0)
+        return 0;
+    if (cache)
+        cache->eraseIf([&](const KeyType& key)
+        {
+            return comparator(key,low)>=0 && comparator(key,high)<=0;
+        });
+    EraseBatch batch;
+    releaseSpine();
+    fingerDepth=0;
     {
-	return -1;
+        PageGuard<Node> rootNode(indexManager,ROOTADDR);
+        eraseInNode(rootNode.get(),low,high,false,batch);
+        collapseRoot(rootNode.get());
     }
-    if (position>0) 
-    { 
-        left=(Node*)(indexManager->getAddr(currentNode->childAddr[position-1]));
-	leftNum=left->num; 
+    if (batch.keys.empty())
+        return 0;
+    keyManager->removeBatch(&batch.keys[0],(int)batch.keys.size());
+    Storage::releaseBatch(dataManager,&batch.values[0],(int)batch.values.size());
+    if (!batch.nodes.empty())
+        indexManager->removeBatch(&batch.nodes[0],(int)batch.nodes.size());
+    if (filter)
+        filter->erased((long long)batch.keys.size());
+    keysChanged();
+    return (long long)batch.keys.size();
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::apply(const WriteBatch<KeyType,ValueType>& batch)
+{
+    typedef typename WriteBatch<KeyType,ValueType>::Entry Entry;
+    vector<int> order(batch.size());
+    for (int i=0;i<batch.size();i++)
+        order[i]=i;
+    std::stable_sort(order.begin(),order.end(),[&](int left,int right)
+    {
+        return comparator(batch.get(left).key,batch.get(right).key)<0;
+    });
+    vector<KeyType> removed;
+    {
+        BatchScope scope(this);
+        PageGuard<Node> held[MAXHEIGHT];
+        for (int i=0;i<batch.size();i++)
+        {
+            const Entry& entry=batch.get(order[i]);
+            batchNext=i+1<batch.size() && batch.get(order[i+1]).op==WriteBatch<KeyType,ValueType>::PUT?&batch.get(order[i+1]).key:NULL;
+            if (entry.op==WriteBatch<KeyType,ValueType>::PUT)
+                insertOrAssign(entry.key,entry.value);
+            else if (entry.op==WriteBatch<KeyType,ValueType>::UPDATE)
+                tryUpdate(entry.key,entry.value);
+            else
+            {
+                remove(entry.key);
+                removed.push_back(entry.key);
+            }
+            for (int level=0;level<fingerDepth;level++)
+                if (!held[level].valid() || (held[level].address()>>12)!=(finger[level].addr>>12))
+                    held[level]=PageGuard<Node>(indexManager,finger[level].addr);
+        }
     }
-    else leftNum=-1;
-    if (currentNode->num>position+1) 
+    if (removed.empty() || !mergeThreshold)
+        return;
+    releaseSpine();
+    fingerDepth=0;
+    PageGuard<Node> rootNode(indexManager,ROOTADDR);
+    repairNode(rootNode.get(),removed,0,(int)removed.size());
+    collapseRoot(rootNode.get());
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::repairNode(Node* currentNode,const vector<KeyType>& keys,int first,int last)
+{
+    if (currentNode->isLeaf)
+        return;
+    long long touched[BTORDER];
+    int touchedNum=0;
+    for (int i=0;i<currentNode->num && first<last;i++)
     {
-        right=(Node*)(indexManager->getAddr(currentNode->childAddr[position+1]));
-	rightNum=right->num;
+        int end=first;
+        while (end<last && (i==currentNode->num-1 || compareKey(currentNode->keyAddr[i],keys[end])>=0))
+            end++;
+        if (end==first)
+            continue;
+        {
+            PageGuard<Node> child(indexManager,currentNode->childAddr[i]);
+            repairNode(child.get(),keys,first,end);
+        }
+        touched[touchedNum++]=currentNode->childAddr[i];
+        first=end;
     }
-    else rightNum=-1;
-    if (leftNum+rightNum==-2) return -1;
-    if (leftNum==-1 && rightNum>(BTORDER+1)>>1)
+    for (int j=0;j<touchedNum;j++)
     {
-        currentAddress=currentNode->childAddr[position-1];
-        indexManager->unMapAddr(currentNode->childAddr[position-1]);
-	left=NULL;
+        int position=0;
+        while (position<currentNode->num && currentNode->childAddr[position]!=touched[j])
+            position++;
+        if (position==currentNode->num || currentNode->num==1)
+            continue;
+        bool halfEmpty;
+        {
+            PageGuard<Node> child(indexManager,touched[j]);
+            halfEmpty=child->num < mergeThreshold;
+        }
+        if (halfEmpty && borrowFromSibling(currentNode,position)==-1)
+            combine(currentNode,position);
     }
-    else if (rightNum==-1 && leftNum>(BTORDER+1)>>1)
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::clear()
+{
+    releaseSpine();
+    releaseUpper();
+    fingerDepth=0;
+    indexManager->reset();
+    keyManager->reset();
+    dataManager->reset();
+    if (filter)
+        filter->reset(filter->getBits());
+    keysChanged();
+    if (cache)
+        cache->clear();
+    addNodeInMemory();
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::compareKey(long long keyAddress,const KeyType& key)
+{
+    typename KeyStorage<KeyType>::Guard storedKey(keyManager,Separator::address(keyAddress));
+    return comparator(*storedKey,key);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::eraseInNode(Node* currentNode,const KeyType& low,const KeyType& high,bool lowCovered,EraseBatch& batch)
+{
+    if (currentNode->isLeaf)
     {
-        currentAddress=currentNode->childAddr[position+1];
-        indexManager->unMapAddr(currentNode->childAddr[position+1]);
-	right=NULL;
+        int kept=0;
+        for (int i=0;i<currentNode->num;i++)
+        {
+            if ((lowCovered || compareKey(currentNode->keyAddr[i],low)>=0) && compareKey(currentNode->keyAddr[i],high)<=0)
+            {
+                batch.keys.push_back(currentNode->keyAddr[i]);
+                batch.values.push_back(currentNode->childAddr[i]);
+                continue;
+            }
+            currentNode->keyAddr[kept]=currentNode->keyAddr[i];
+            currentNode->childAddr[kept]=currentNode->childAddr[i];
+            currentNode->count[kept]=currentNode->count[i];
+            currentNode->partial[kept++]=currentNode->partial[i];
+        }
+        currentNode->num=kept;
+        return;
     }
-    else if (leftNum>(BTORDER+1)>>1 && rightNum>(BTORDER+1)>>1)
+    long long boundary[2];
+    int boundaryNum=0;
+    int i=0;
+    while (i<currentNode->num)
     {
-        if (leftNum>=rightNum)
-	{
-            currentAddress=currentNode->childAddr[position+1];
-	    indexManager->unMapAddr(currentNode->childAddr[position+1]);
-	    right=NULL;
-	}
-	else 
-	{
-	    currentAddress=currentNode->childAddr[position-1];
-	    indexManager->unMapAddr(currentNode->childAddr[position-1]);
-	    left=NULL;
-	}
+        if (i>0 && compareKey(currentNode->keyAddr[i-1],high)>=0)
+            break;
+        if (compareKey(currentNode->keyAddr[i],low)<0)
+        {
+            i++;
+            continue;
+        }
+        bool childLow=i>0?compareKey(currentNode->keyAddr[i-1],low)>=0:lowCovered;
+        if (childLow && compareKey(currentNode->keyAddr[i],high)<=0)
+            freeSubtree(currentNode->childAddr[i],batch);
+        else
+        {
+            PageGuard<Node> child(indexManager,currentNode->childAddr[i]);
+            eraseInNode(child.get(),low,high,childLow,batch);
+            currentNode->count[i]=subtreeCount(child.get());
+            currentNode->partial[i]=foldNode(child.get());
+            if (child->num)
+            {
+                if (Separator::address(currentNode->keyAddr[i])==currentNode->keyAddr[i] && compareKey(currentNode->keyAddr[i],high)<=0)
+                    currentNode->keyAddr[i]=Separator::copy(keyManager,child->keyAddr[child->num-1]);
+                if (boundaryNum<2)
+                    boundary[boundaryNum++]=currentNode->childAddr[i];
+                i++;
+                continue;
+            }
+            batch.nodes.push_back(currentNode->childAddr[i]);
+        }
+        Separator::drop(keyManager,currentNode->keyAddr[i]);
+        removeInNode(currentNode,i);
     }
-    else 
+    for (int j=0;j<boundaryNum;j++)
     {
-        indexManager->unMapAddr(currentNode->childAddr[position+1]);
-        indexManager->unMapAddr(currentNode->childAddr[position-1]);
-        return -1;
+        int position=0;
+        while (position<currentNode->num && currentNode->childAddr[position]!=boundary[j])
+            position++;
+        if (position==currentNode->num)
+            continue;
+        bool halfEmpty;
+        {
+            PageGuard<Node> child(indexManager,boundary[j]);
+            halfEmpty=child->num < mergeThreshold;
+        }
+        if (halfEmpty && borrowFromSibling(currentNode,position)==-1)
+            combine(currentNode,position);
     }
-    if (left)
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::freeSubtree(long long address,EraseBatch& batch)
+{
     {
-        keyAddress=left->keyAddr[left->num-1];
-	childAddress=left->childAddr[left->num-1];
-        index=left->keyAddr[left->num-2];
-	removeInNode(left,left->num-1);
-	indexManager->unMapAddr(currentAddress);
-	return 1;
+        PageGuard<Node> currentNode(indexManager,address);
+        for (int i=0;i<currentNode->num;i++)
+        {
+            if (currentNode->isLeaf)
+            {
+                batch.keys.push_back(currentNode->keyAddr[i]);
+                batch.values.push_back(currentNode->childAddr[i]);
+                continue;
+            }
+            freeSubtree(currentNode->childAddr[i],batch);
+            Separator::drop(keyManager,currentNode->keyAddr[i]);
+        }
+    }
+    batch.nodes.push_back(address);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::size()
+{
+    PageGuard<Node> rootNode(indexManager,ROOTADDR);
+    return subtreeCount(rootNode.get());
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::rank(const KeyType& key)
+{
+    return countBelow(key,false);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::count(const KeyType& low,const KeyType& high)
+{
+    if (comparator(low,high)>0)
+        return 0;
+    return countBelow(high,true)-countBelow(low,false);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+KeyType BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::select(long long index)
+{
+    PageGuard<Node> currentNode(indexManager,ROOTADDR);
+    if (index<0 || index>=subtreeCount(currentNode.get()))
+        throw string("BPLUSMAP SELECT ERROR: INDEX OUT OF RANGE!");
+    while (!currentNode->isLeaf)
+    {
+        int position=0;
+        while (index>=currentNode->count[position])
+            index-=currentNode->count[position++];
+        currentNode=PageGuard<Node>(indexManager,currentNode->childAddr[position]);
     }
-    if (right)
+    return keyManager->getValue(currentNode->keyAddr[index]);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+KeyType BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::sample()
+{
+    long long total=size();
+    if (total==0)
+        throw string("BPLUSMAP EMPTY");
+    long long index=((long long)rand()*((long long)RAND_MAX+1)+rand())%total;
+    return select(index);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::countBelow(const KeyType& key,bool inclusive)
+{
+    long long result=0;
+    PageGuard<Node> currentNode(indexManager,ROOTADDR);
+    while (!currentNode->isLeaf)
     {
-        keyAddress=right->keyAddr[0];
-	childAddress=right->childAddr[0];
-	index=right->keyAddr[0];
-	removeInNode(right,0);
-        indexManager->unMapAddr(currentAddress);
-	return 2;
+        int position=searchInNode(currentNode.get(),key,0);
+        for (int i=0;i<position;i++)
+            result+=currentNode->count[i];
+        if (position==currentNode->num)
+            return result;
+        currentNode=PageGuard<Node>(indexManager,currentNode->childAddr[position]);
+    }
+    int position=searchInNode(currentNode.get(),key,0);
+    if (inclusive && position<currentNode->num && compareKey(currentNode->keyAddr[position],key)==0)
+        position++;
+    return result+position;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+long long BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::subtreeCount(Node* currentNode)
+{
+    long long total=0;
+    for (int i=0;i<currentNode->num;i++)
+        total+=currentNode->count[i];
+    return total;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+typename Aggregate::Type BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::aggregate(const KeyType& low,const KeyType& high)
+{
+    typename Aggregate::Type result=Aggregate::identity();
+    if (comparator(low,high)>0)
+        return result;
+    PageGuard<Node> rootNode(indexManager,ROOTADDR);
+    aggregateInNode(rootNode.get(),low,high,false,result);
+    return result;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::aggregateInNode(Node* currentNode,const KeyType& low,const KeyType& high,bool lowCovered,typename Aggregate::Type& result)
+{
+    for (int i=0;i<currentNode->num;i++)
+    {
+        if (currentNode->isLeaf)
+        {
+            if ((lowCovered || compareKey(currentNode->keyAddr[i],low)>=0) && compareKey(currentNode->keyAddr[i],high)<=0)
+                result=Aggregate::combine(result,currentNode->partial[i]);
+            continue;
+        }
+        if (i>0 && compareKey(currentNode->keyAddr[i-1],high)>=0)
+            break;
+        if (compareKey(currentNode->keyAddr[i],low)<0)
+            continue;
+        bool childLow=i>0?compareKey(currentNode->keyAddr[i-1],low)>=0:lowCovered;
+        if (childLow && compareKey(currentNode->keyAddr[i],high)<=0)
+            result=Aggregate::combine(result,currentNode->partial[i]);
+        else
+        {
+            PageGuard<Node> child(indexManager,currentNode->childAddr[i]);
+            aggregateInNode(child.get(),low,high,childLow,result);
+        }
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+typename Aggregate::Type BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::foldNode(Node* currentNode)
+{
+    typename Aggregate::Type result=Aggregate::identity();
+    for (int i=0;i<currentNode->num;i++)
+        result=Aggregate::combine(result,currentNode->partial[i]);
+    return result;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::refreshEntry(Node* currentNode,int position)
+{
+    if (currentNode->isLeaf)
+    {
+        currentNode->partial[position]=Aggregate::lift(Storage::load(dataManager,currentNode->childAddr[position]));
+        return;
+    }
+    PageGuard<Node> child(indexManager,currentNode->childAddr[position]);
+    currentNode->partial[position]=foldNode(child.get());
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::valueChanged(const KeyType& key)
+{
+    if (Aggregate::enabled)
+        refreshPath(key);
+    if (cache)
+        cache->erase(key);
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::keysChanged()
+{
+    indexManager->touch();
+    if (filter)
+        filter->setStamp(indexManager->getStamp());
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::refreshPath(const KeyType& key)
+{
+    Record record[MAXHEIGHT];
+    int depth=0;
+    PageGuard<Node> currentNode(indexManager,ROOTADDR);
+    while (!currentNode->isLeaf)
+    {
+        int position=searchInNode(currentNode.get(),key,0);
+        if (position==currentNode->num)
+            position--;
+        long long address=currentNode->childAddr[position];
+        record[depth].guard=std::move(currentNode);
+        record[depth++].pos=position;
+        currentNode=PageGuard<Node>(indexManager,address);
+    }
+    int position=searchInNode(currentNode.get(),key,2);
+    if (position!=-1)
+        refreshEntry(currentNode.get(),position);
+    typename Aggregate::Type folded=foldNode(currentNode.get());
+    currentNode.release();
+    while (depth)
+    {
+        Node* node=record[depth-1].guard.get();
+        position=record[depth-1].pos;
+        node->partial[position]=folded;
+        folded=foldNode(node);
+        record[--depth].guard.release();
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::setMergeThreshold(int threshold)
+{
+    if (threshold<0 || threshold>((BTORDER+1)>>1))
+        throw string("BPLUSMAP THRESHOLD ERROR: THRESHOLD OUT OF RANGE!");
+    mergeThreshold=threshold;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::rebalance(int maxFixes)
+{
+    int budget=maxFixes;
+    releaseSpine();
+    fingerDepth=0;
+    PageGuard<Node> rootNode(indexManager,ROOTADDR);
+    int fixed=0,pass;
+    do
+    {
+        pass=rebalanceNode(rootNode.get(),budget);
+        fixed+=pass;
+        collapseRoot(rootNode.get());
+    } while (pass && budget>0);
+    return fixed;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+void BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::collapseRoot(Node* rootNode)
+{
+    if (!rootNode->isLeaf && rootNode->num==0)
+        rootNode->isLeaf=true;
+    while (!rootNode->isLeaf && rootNode->num==1)
+    {
+        long long onlyChild=rootNode->childAddr[0];
+        {
+            PageGuard<Node> child(indexManager,onlyChild);
+            *rootNode=*child;
+        }
+        indexManager->remove(onlyChild);
     }
-    return -1;
 }
 
-template<typename KeyType,typename ValueType>
-int BPlusMap<KeyType,ValueType>::
-combine(Node* currentNode,long long & index,long long & keyAddress,long long & childAddress,int position)
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::rebalanceNode(Node* currentNode,int& budget)
 {
-    Node* child=(Node*)(indexManager->getAddr(currentNode->childAddr[position]));
-    if (currentNode->num<2)
+    int fixed=0;
+    if (currentNode->isLeaf)
+        return 0;
+    for (int i=0;i<currentNode->num && budget>0;i++)
+    {
+        PageGuard<Node> child(indexManager,currentNode->childAddr[i]);
+        fixed+=rebalanceNode(child.get(),budget);
+    }
+    int i=0;
+    while (i<currentNode->num && budget>0)
     {
-	return -1;
+        bool underfull;
+        {
+            PageGuard<Node> child(indexManager,currentNode->childAddr[i]);
+            underfull=child->num < ((BTORDER+1)>>1);
+        }
+        if (!underfull || currentNode->num==1)
+        {
+            i++;
+            continue;
+        }
+        if (borrowFromSibling(currentNode,i)==-1 && combine(currentNode,i)==1)
+            i--;
+        budget--;
+        fixed++;
     }
-    Node* left=NULL;
-    Node* right=NULL;
+    return fixed;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::borrowFromSibling(Node* currentNode,int position,int minNum)
+{
+    PageGuard<Node> child(indexManager,currentNode->childAddr[position]);
+    if (child->num==BTORDER)
+        return -1;
     if (position>0)
-        left=(Node*)(indexManager->getAddr(currentNode->childAddr[position-1]));
-    else if (currentNode->num-1-position>0)
-        right=(Node*)(indexManager->getAddr(currentNode->childAddr[position+1]));
-    else 
     {
-	return -1;
+        PageGuard<Node> left(indexManager,currentNode->childAddr[position-1]);
+	if (left->num>minNum)
+	{
+	    long long moved=left->count[left->num-1];
+	    insertInNode(child.get(),left->keyAddr[left->num-1],left->childAddr[left->num-1],moved,0);
+	    child->partial[0]=left->partial[left->num-1];
+	    removeInNode(left.get(),left->num-1);
+	    currentNode->count[position-1]-=moved;
+	    currentNode->count[position]+=moved;
+	    currentNode->partial[position-1]=foldNode(left.get());
+	    currentNode->partial[position]=foldNode(child.get());
+	    Separator::drop(keyManager,currentNode->keyAddr[position-1]);
+	    currentNode->keyAddr[position-1]=Separator::copy(keyManager,left->keyAddr[left->num-1]);
+	    return 1;
+	}
+    }
+    if (position<currentNode->num-1)
+    {
+        PageGuard<Node> right(indexManager,currentNode->childAddr[position+1]);
+	if (right->num>minNum)
+	{
+	    long long moved=right->count[0];
+	    insertInNode(child.get(),right->keyAddr[0],right->childAddr[0],moved,child->num);
+	    child->partial[child->num-1]=right->partial[0];
+	    removeInNode(right.get(),0);
+	    currentNode->count[position+1]-=moved;
+	    currentNode->count[position]+=moved;
+	    currentNode->partial[position+1]=foldNode(right.get());
+	    currentNode->partial[position]=foldNode(child.get());
+	    Separator::drop(keyManager,currentNode->keyAddr[position]);
+	    currentNode->keyAddr[position]=Separator::copy(keyManager,child->keyAddr[child->num-1]);
+	    return 2;
+	}
     }
-    if (left)
+    return -1;
+}
+
+template<typename KeyType,typename ValueType,typename Compare,typename Storage,typename Aggregate>
+int BPlusMap<KeyType,ValueType,Compare,Storage,Aggregate>::combine(Node* currentNode,int position)
+{
+    PageGuard<Node> child(indexManager,currentNode->childAddr[position]);
+    if (position>0)
     {
-        if (right) 
-	    indexManager->unMapAddr(currentNode->childAddr[position+1]);
-	index=child->keyAddr[child->num-1];
+        PageGuard<Node> left(indexManager,currentNode->childAddr[position-1]);
+	if (left->num+child->num>BTORDER)
+	{
+	    left.release();
+	    child.release();
+	    return borrowFromSibling(currentNode,position,1)==-1?-1:0;
+	}
 	for (int i=0;i<child->num;i++)
 	{
 	    left->keyAddr[left->num+i]=child->keyAddr[i];
 	    left->childAddr[left->num+i]=child->childAddr[i];
+	    left->count[left->num+i]=child->count[i];
+	    left->partial[left->num+i]=child->partial[i];
 	}
 	left->num+=child->num;
-	indexManager->unMapAddr(currentNode->childAddr[position]);
-	indexManager->unMapAddr(currentNode->childAddr[position-1]);
+	currentNode->count[position-1]+=currentNode->count[position];
+	currentNode->partial[position-1]=Aggregate::combine(currentNode->partial[position-1],currentNode->partial[position]);
+	Separator::drop(keyManager,currentNode->keyAddr[position-1]);
+	currentNode->keyAddr[position-1]=currentNode->keyAddr[position];
+	child.release();
 	indexManager->remove(currentNode->childAddr[position]);
+	removeInNode(currentNode,position);
 	return 1;
     }
-    else if (right)
+    if (position<currentNode->num-1)
     {
-        if (left) indexManager->unMapAddr(currentNode->childAddr[position-1]);
-	index=right->keyAddr[right->num-1];
+        PageGuard<Node> right(indexManager,currentNode->childAddr[position+1]);
+	if (child->num+right->num>BTORDER)
+	{
+	    right.release();
+	    child.release();
+	    return borrowFromSibling(currentNode,position,1)==-1?-1:0;
+	}
 	for (int i=0;i<right->num;i++)
 	{
 	    child->keyAddr[child->num+i]=right->keyAddr[i];
 	    child->childAddr[child->num+i]=right->childAddr[i];
+	    child->count[child->num+i]=right->count[i];
+	    child->partial[child->num+i]=right->partial[i];
 	}
 	child->num+=right->num;
-	indexManager->unMapAddr(currentNode->childAddr[position]);
-	indexManager->unMapAddr(currentNode->childAddr[position+1]);
+	currentNode->count[position]+=currentNode->count[position+1];
+	currentNode->partial[position]=Aggregate::combine(currentNode->partial[position],currentNode->partial[position+1]);
+	Separator::drop(keyManager,currentNode->keyAddr[position]);
+	currentNode->keyAddr[position]=currentNode->keyAddr[position+1];
+	right.release();
 	indexManager->remove(currentNode->childAddr[position+1]);
+	removeInNode(currentNode,position+1);
 	return 2;
     }
-    else
-    {
-        return -1;
-    }
+    return -1;
 }
 
-
 #endif
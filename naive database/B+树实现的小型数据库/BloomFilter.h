@@ -0,0 +1,146 @@
+#ifndef _BLOOMFILTER_H_
+#define _BLOOMFILTER_H_
+
+#include "MemoryHandler.h"
+
+#define FILTERHASHES (7)
+#define FILTERBITSPERKEY (10)
+#define FILTERSTALE (25)
+
+
+class BloomFilter
+{
+public:
+    BloomFilter(const char* fileName,long long bits);
+    ~BloomFilter();
+    void add(unsigned long long hash);
+    bool mayContain(unsigned long long hash);
+    void erased(long long count)  { header->erased+=count; }
+    bool stale();
+    bool fresh()                  { return created; }
+    long long live()              { return header->added-header->erased; }
+    void reset(long long bits);
+    long long getBits()           { return header->bits; }
+    long long getStamp()          { return header->stamp; }
+    void setStamp(long long stamp) { header->stamp=stamp; }
+    static unsigned long long hash(const char* data,long long length);
+private:
+    struct Header
+    {
+        long long bits;
+	long long added;
+	long long erased;
+	long long stamp;
+    };
+    int fd;
+    bool created;
+    Header* header;
+    unsigned char* bitmap;
+    long long mappedLength;
+    BloomFilter(){};
+    BloomFilter(const BloomFilter&);
+    BloomFilter& operator=(const BloomFilter&);
+    void mapBitmap();
+};
+
+
+
+inline BloomFilter::BloomFilter(const char* fileName,long long bits)
+{
+    char pageInitialize[PAGESIZE];
+    memset(pageInitialize,0,PAGESIZE);
+    bitmap=NULL;
+    created=false;
+    fd = open(fileName, O_RDWR, S_IREAD | S_IWRITE);
+    if (fd == -1)
+    {
+        fd = open(fileName, O_RDWR | O_CREAT, S_IREAD | S_IWRITE);
+        if (fd == -1)
+            throw string("Bloom Filter Error: file open failed!");
+        ::write(fd, pageInitialize, PAGESIZE);
+    }
+    header=static_cast<Header*>(mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (header->bits == 0)
+    {
+        reset(bits);
+        created=true;
+    }
+    else
+        mapBitmap();
+}
+
+inline BloomFilter::~BloomFilter()
+{
+    munmap(bitmap,(size_t)mappedLength);
+    munmap(header,sizeof(Header));
+    close(fd);
+}
+
+inline void BloomFilter::mapBitmap()
+{
+    mappedLength=(((header->bits+7)>>3)+PAGESIZE-1) & ~(long long)(PAGESIZE-1);
+    bitmap=static_cast<unsigned char*>(mmap(NULL, (size_t)mappedLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PAGESIZE));
+}
+
+inline void BloomFilter::reset(long long bits)
+{
+    if (bitmap)
+        munmap(bitmap,(size_t)mappedLength);
+    if (bits<PAGESIZE<<3)
+        bits=PAGESIZE<<3;
+    header->bits=bits;
+    header->added=0;
+    header->erased=0;
+    if (ftruncate(fd,PAGESIZE)==-1)
+        throw string("Bloom Filter Error: file truncate failed!");
+    if (ftruncate(fd,PAGESIZE+((((bits+7)>>3)+PAGESIZE-1) & ~(long long)(PAGESIZE-1)))==-1)
+        throw string("Bloom Filter Error: file truncate failed!");
+    mapBitmap();
+}
+
+inline unsigned long long BloomFilter::hash(const char* data,long long length)
+{
+    unsigned long long result=14695981039346656037ULL;
+    for (long long i=0;i<length;i++)
+    {
+        result^=(unsigned char)data[i];
+        result*=1099511628211ULL;
+    }
+    result^=result>>33;
+    result*=0xff51afd7ed558ccdULL;
+    result^=result>>33;
+    return result;
+}
+
+inline void BloomFilter::add(unsigned long long hash)
+{
+    unsigned long long step=(hash>>32) | 1;
+    for (int i=0;i<FILTERHASHES;i++)
+    {
+        unsigned long long bit=(hash+i*step)%(unsigned long long)header->bits;
+        bitmap[bit>>3]|=(unsigned char)(1<<(bit & 7));
+    }
+    header->added++;
+}
+
+inline bool BloomFilter::mayContain(unsigned long long hash)
+{
+    unsigned long long step=(hash>>32) | 1;
+    for (int i=0;i<FILTERHASHES;i++)
+    {
+        unsigned long long bit=(hash+i*step)%(unsigned long long)header->bits;
+        if (!(bitmap[bit>>3] & (1<<(bit & 7))))
+            return false;
+    }
+    return true;
+}
+
+inline bool BloomFilter::stale()
+{
+    if (header->erased*100>header->added*FILTERSTALE)
+        return true;
+    return live()*FILTERBITSPERKEY>header->bits;
+}
+
+
+#endif
@@ -6,6 +6,9 @@
 //#include "mman.h"
 #include <cstring>
 #include <string>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
 #include "types.h"
 #include <sys/stat.h>
 #include <fcntl.h> 
@@ -17,25 +20,231 @@ using namespace std;
 #define SHIFT (5)
 #define MASK  (0x1F)
 #define BITMAPSIZE (128)
-#define PAGEREST (PAGESIZE-BITMAPSIZE*4-sizeof(long))
+#define PAGEHEAD (2*sizeof(int))
+#define PAGEREST (PAGESIZE-BITMAPSIZE*4-PAGEHEAD)
 
+template<int Offset,int Align>
+struct AlignUp
+{
+    enum { value=(Offset+Align-1)/Align*Align };
+};
+
+template<int Align,int Slots>
+struct SlotOffset
+{
+    enum { value=AlignUp<PAGEHEAD+(Slots+MASK)/(MASK+1)*sizeof(int),Align>::value };
+};
+
+template<int Size,int Align,int Slots,bool Fits=(SlotOffset<Align,Slots>::value+Slots*Size<=PAGESIZE)>
+struct SlotCount
+{
+    enum { value=SlotCount<Size,Align,Slots-1>::value };
+};
+
+template<int Size,int Align,int Slots>
+struct SlotCount<Size,Align,Slots,true>
+{
+    enum { value=Slots };
+};
+
+template<typename ValueType,bool Packed=std::is_trivially_copyable<ValueType>::value>
+struct PageLayout
+{
+    enum
+    {
+        VALUESIZE=sizeof(ValueType),
+        BITMAPWORDS=BITMAPSIZE,
+        DATAOFFSET=PAGESIZE-PAGEREST,
+        CAPACITY=PAGEREST/VALUESIZE<BITMAPSIZE*(MASK+1)?PAGEREST/VALUESIZE:BITMAPSIZE*(MASK+1)
+    };
+};
+
+template<typename ValueType>
+struct PageLayout<ValueType,true>
+{
+    enum
+    {
+        VALUESIZE=sizeof(ValueType),
+        CAPACITY=SlotCount<VALUESIZE,std::alignment_of<ValueType>::value,((PAGESIZE-PAGEHEAD)*8)/(VALUESIZE*8+1)>::value,
+        BITMAPWORDS=(CAPACITY+MASK)/(MASK+1),
+        DATAOFFSET=SlotOffset<std::alignment_of<ValueType>::value,CAPACITY>::value
+    };
+};
+
+
+class PageCache
+{
+public:
+    PageCache():fd(-1),valueCache(NULL),freeCache(NULL),mappedPages(0){};
+    ~PageCache();
+    void setFile(int fileDescriptor) { fd=fileDescriptor; }
+    char* pin(long pageNum,int pageCount=1);
+    void unpin(long pageNum);
+    char* lookup(long pageNum);
+    int getMappedPages() { return mappedPages; }
+private:
+    struct AddrCache
+    {
+        AddrCache():next(NULL),prev(NULL){};
+        AddrCache* next;
+	AddrCache* prev;
+	long pageNum;
+	int pageCount;
+	int invokeTime;
+	char* firstAddr;
+    };
+    int fd;
+    AddrCache* valueCache;
+    AddrCache* freeCache;
+    int mappedPages;
+    void releaseCache(AddrCache* cache)
+    {
+        cache->prev=NULL;
+        cache->next=freeCache;
+        freeCache=cache;
+    }
+    PageCache(const PageCache&);
+    PageCache& operator=(const PageCache&);
+};
+
+inline PageCache::~PageCache()
+{
+    while (valueCache)
+    {
+        AddrCache* tmp=valueCache;
+        valueCache=valueCache->next;
+        munmap(tmp->firstAddr,tmp->pageCount*PAGESIZE);
+        delete tmp;
+    }
+    while (freeCache)
+    {
+        AddrCache* tmp=freeCache;
+        freeCache=freeCache->next;
+        delete tmp;
+    }
+}
+
+inline char* PageCache::lookup(long pageNum)
+{
+    AddrCache* tmp=valueCache;
+    while (tmp)
+    {
+        if (tmp->pageNum==pageNum)
+            return tmp->firstAddr;
+        tmp=tmp->next;
+    }
+    return NULL;
+}
+
+inline char* PageCache::pin(long pageNum,int pageCount)
+{
+    AddrCache* tmp;
+    tmp=valueCache;
+    while (tmp)
+    {
+        if (tmp->pageNum==pageNum)
+	{
+	    tmp->invokeTime++;
+	    return tmp->firstAddr;
+	}
+	tmp=tmp->next;
+    }
+
+    char* currentPage=static_cast<char*>(mmap(NULL,pageCount*PAGESIZE,PROT_READ | PROT_WRITE, MAP_SHARED, fd, pageNum<<12));
+    AddrCache* newCache;
+    if (freeCache)
+    {
+        newCache=freeCache;
+        freeCache=freeCache->next;
+        newCache->next=NULL;
+    }
+    else
+        newCache=new AddrCache;
+    mappedPages++;
+    newCache->pageNum=pageNum;
+    newCache->pageCount=pageCount;
+    newCache->invokeTime=1;
+    newCache->firstAddr=currentPage;
+    if (!valueCache) 
+    {
+        valueCache=newCache;
+    }
+    else 
+    {
+        newCache->prev=valueCache;
+        newCache->next=valueCache->next;
+	if (newCache->next) newCache->next->prev=newCache;
+	valueCache->next=newCache;
+    }
+    return currentPage;
+}
+
+inline void PageCache::unpin(long pageNum)
+{
+    AddrCache* tmp;
+    tmp=valueCache;
+    while (tmp)
+    {
+        if (tmp->pageNum==pageNum)
+	{
+	    tmp->invokeTime--;
+	    if (tmp->invokeTime==0)
+	    {
+	        munmap(tmp->firstAddr,tmp->pageCount*PAGESIZE);
+		mappedPages--;
+		if (tmp->prev && tmp->next)
+		{
+		    tmp->prev->next=tmp->next;
+		    tmp->next->prev=tmp->prev;
+		    releaseCache(tmp);
+		}
+		else if (tmp->prev)
+		{
+		    tmp->prev->next=NULL;
+		    tmp->prev=NULL;
+		    releaseCache(tmp);
+		}
+		else if (tmp->next)
+		{
+		    tmp->next->prev=NULL;
+		    valueCache=tmp->next;
+		    tmp->next=NULL;
+		    releaseCache(tmp);
+		}
+		else
+		{
+		    releaseCache(tmp);
+		    valueCache=NULL;
+		}
+	    }
+	    break;
+	}
+	tmp=tmp->next;
+    }
+}
 
 template<typename ValueType>
 class MemoryHandler
 {
 public:
     MemoryHandler(const char* filename);
-    long long insert(ValueType* value);
+    ~MemoryHandler();
+    long long insert(const ValueType* value);
+    long long allocate();
     void remove(long long addr);
-    void update(long long addr,ValueType* value);
+    void removeBatch(long long* addr,int count);
+    void reset();
+    void update(long long addr,const ValueType* value);
     void* getAddr(long long addr);
     void unMapAddr(long long addr);
-    int compare(long long addr,const ValueType& value);
     ValueType getValue(long long addr);
     long getTotal();
+    long long getStamp();
+    void touch();
+    int getMappedPages();
 private:
+    typedef PageLayout<ValueType> Layout;
     int fd;
-    int valueCapacity;
     char pageInitialize[PAGESIZE];
     MemoryHandler(){};
     struct Header
@@ -43,20 +252,23 @@ private:
         long total;
 	long valueEmpty;
 	int valueSize;
+	long long stamp;
     };
     Header* header;
+    PageCache pageCache;
     struct ValuePage
     {
         int nextEmptyPage;
 	int firstEmptyRoom;
-	int emptyBitmap[BITMAPSIZE];
-        char value[PAGEREST];
+	int emptyBitmap[Layout::BITMAPWORDS];
+        char rest[PAGESIZE-PAGEHEAD-Layout::BITMAPWORDS*sizeof(int)];
         void initialize()
 	{
 	   nextEmptyPage = 0;
 	   firstEmptyRoom=0;
-           memset(emptyBitmap,0,BITMAPSIZE*sizeof(int));
+           memset(emptyBitmap,0,Layout::BITMAPWORDS*sizeof(int));
         }
+	char* value()       { return (char*)this+Layout::DATAOFFSET; }
 	void set(int i)     {        emptyBitmap[i>>SHIFT] |=  (1<<(i&MASK));}
 
         void clear(int i)   {        emptyBitmap[i>>SHIFT] &= ~(1<<(i&MASK));}
@@ -65,16 +277,6 @@ private:
 
     };
 
-    struct AddrCache
-    {
-        AddrCache():next(NULL),prev(NULL){};
-        AddrCache* next;
-	AddrCache* prev;
-	int pageNum;
-	int invokeTime;
-	char* firstAddr;
-    };
-    AddrCache* valueCache;
     void addPage()
     {
         write(fd, pageInitialize, PAGESIZE);
@@ -86,13 +288,89 @@ private:
 };
 
 
+template<typename ValueType>
+class PageGuard
+{
+public:
+    PageGuard():handler(NULL),addr(-1),value(NULL){};
+    PageGuard(MemoryHandler<ValueType>* memoryHandler,long long address)
+        :handler(memoryHandler),addr(address)
+    {
+        value=static_cast<ValueType*>(handler->getAddr(addr));
+    }
+    PageGuard(PageGuard&& other)
+        :handler(other.handler),addr(other.addr),value(other.value)
+    {
+        other.handler=NULL;
+        other.value=NULL;
+    }
+    PageGuard& operator=(PageGuard&& other)
+    {
+        if (this!=&other)
+        {
+            release();
+            handler=other.handler;
+            addr=other.addr;
+            value=other.value;
+            other.handler=NULL;
+            other.value=NULL;
+        }
+        return *this;
+    }
+    ~PageGuard() { release(); }
+    void release()
+    {
+        if (handler)
+            handler->unMapAddr(addr);
+        handler=NULL;
+        value=NULL;
+    }
+    bool valid() const { return value!=NULL; }
+    long long address() const { return addr; }
+    ValueType* get() const { return value; }
+    ValueType& operator*() const { return *value; }
+    ValueType* operator->() const { return value; }
+private:
+    MemoryHandler<ValueType>* handler;
+    long long addr;
+    ValueType* value;
+    PageGuard(const PageGuard&);
+    PageGuard& operator=(const PageGuard&);
+};
+
+template<typename ValueType>
+class PinnedValue
+{
+public:
+    PinnedValue(){};
+    PinnedValue(MemoryHandler<ValueType>* memoryHandler,long long address)
+        :guard(memoryHandler,address){};
+    PinnedValue(PinnedValue&& other)
+        :guard(std::move(other.guard)){};
+    PinnedValue& operator=(PinnedValue&& other)
+    {
+        guard=std::move(other.guard);
+        return *this;
+    }
+    void release() { guard.release(); }
+    bool valid() const { return guard.valid(); }
+    const ValueType* get() const { return guard.get(); }
+    const ValueType& operator*() const { return *guard; }
+    const ValueType* operator->() const { return guard.get(); }
+private:
+    PageGuard<ValueType> guard;
+    PinnedValue(const PinnedValue&);
+    PinnedValue& operator=(const PinnedValue&);
+};
+
 
 template<typename ValueType>
 MemoryHandler<ValueType>::MemoryHandler(const char* fileName)
 {
-    if (sizeof(ValueType)>PAGEREST)
+    if (Layout::CAPACITY==0)
         throw string("Memory Handler Error: Value Type Size Too Large!");
     memset(pageInitialize,0,PAGESIZE);
+    header=NULL;
     fd = open(fileName, O_RDWR | O_APPEND, S_IREAD | S_IWRITE);
     if (fd == -1)
     {
@@ -101,30 +379,33 @@ MemoryHandler<ValueType>::MemoryHandler(const char* fileName)
             throw string("Memory Handler Error: file open failed!");
         addPage();
     }
-    valueCache=NULL;
+    pageCache.setFile(fd);
     header=static_cast<Header*>(mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
     if (header->total == 0)
     {
         header->total = 1;
         header->valueEmpty=0;
         header->valueSize = sizeof(ValueType);
-        valueCapacity = (PAGEREST) / sizeof(ValueType);
     } 
-    else
-    {	
-        valueCapacity = (PAGEREST) / sizeof(ValueType);
-    }
+    else if (header->valueSize != sizeof(ValueType))
+        throw string("Memory Handler Error: Value Type Size Mismatch!");
+}
+
+template<typename ValueType>
+MemoryHandler<ValueType>::~MemoryHandler()
+{
+    munmap(header,sizeof(Header));
+    close(fd);
 }
 
 template<typename ValueType>
-void MemoryHandler<ValueType>::update(long long addr,ValueType* value)
+void MemoryHandler<ValueType>::update(long long addr,const ValueType* value)
 {
     long currentPageIndex=addr>>12;
     int posInPage=addr & ((1<<12)-1);
-    int indexInPage=(posInPage-(PAGESIZE-PAGEREST))/header->valueSize;
     ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
-    char* dest=(char*)(currentPage->value)+indexInPage*header->valueSize;
-    memcpy(dest,(char*)value,header->valueSize);
+    char* dest=(char*)currentPage+posInPage;
+    memcpy(dest,(const char*)value,Layout::VALUESIZE);
     munmap(currentPage,sizeof(ValuePage));
 }
 
@@ -133,35 +414,24 @@ ValueType MemoryHandler<ValueType>::getValue(long long addr)
 {
     long currentPageIndex=addr>>12;
     int posInPage=addr & ((1<<12)-1);
-    int indexInPage=(posInPage-(PAGESIZE-PAGEREST))/header->valueSize;
     ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
     ValueType dest;
-    memcpy(&dest,(char*)(currentPage->value)+(indexInPage)*header->valueSize,header->valueSize);
+    memcpy(&dest,(char*)currentPage+posInPage,Layout::VALUESIZE);
     munmap(currentPage,sizeof(ValuePage));
     return dest;
 }
 
 template<typename ValueType>
-long long MemoryHandler<ValueType>::insert(ValueType* value)
+long long MemoryHandler<ValueType>::insert(const ValueType* value)
 {
-    AddrCache* tmp;
-    tmp=valueCache;
     ValuePage* currentPage;
     bool isCached=false;
     long long indexAddr;
     int BytePos,BitPos;
     if (header->valueEmpty)
     {
-        while (tmp)
-        {
-            if (header->valueEmpty==tmp->pageNum)
-    	    {
-	        currentPage=(ValuePage*)(tmp->firstAddr-(PAGESIZE-PAGEREST));
-  	        isCached=true;
-	        break;
-	    }
-	    tmp=tmp->next;
-	}
+        currentPage=(ValuePage*)(pageCache.lookup(header->valueEmpty));
+        isCached=currentPage!=NULL;
 	if (!isCached)
 	 currentPage=(ValuePage*)(mmap(NULL, sizeof(ValuePage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, (header->valueEmpty)<<12));
     }
@@ -172,17 +442,18 @@ long long MemoryHandler<ValueType>::insert(ValueType* value)
 	currentPage->initialize();
 	header->valueEmpty=header->total-1;
     }
-    indexAddr=(header->valueEmpty)*PAGESIZE+PAGESIZE-PAGEREST+(currentPage->firstEmptyRoom)*header->valueSize;
-    char* dest=static_cast<char*>(currentPage->value)+header->valueSize*(currentPage->firstEmptyRoom);
-    memcpy(dest,(char*)(value),header->valueSize);
+    indexAddr=(header->valueEmpty)*PAGESIZE+Layout::DATAOFFSET+(currentPage->firstEmptyRoom)*Layout::VALUESIZE;
+    char* dest=currentPage->value()+Layout::VALUESIZE*(currentPage->firstEmptyRoom);
+    if (value)
+        memcpy(dest,(const char*)(value),Layout::VALUESIZE);
     currentPage->set(currentPage->firstEmptyRoom);
-    for (BytePos=(currentPage->firstEmptyRoom)>>3;BytePos<=valueCapacity>>3;BytePos++)
+    for (BytePos=(currentPage->firstEmptyRoom)>>SHIFT;BytePos<=(Layout::CAPACITY-1)>>SHIFT;BytePos++)
     {
-        if (currentPage->emptyBitmap[BytePos]!=0xFF) break;
+        if (currentPage->emptyBitmap[BytePos]!=~0) break;
     }
-    for (BitPos=BytePos<<3;BitPos<(BytePos+1)<<3;BitPos++)
+    for (BitPos=BytePos<<SHIFT;BitPos<(BytePos+1)<<SHIFT;BitPos++)
     {
-        if (BitPos>=valueCapacity)
+        if (BitPos>=Layout::CAPACITY)
 	{
 	    header->valueEmpty=currentPage->nextEmptyPage;
 	    currentPage->firstEmptyRoom=-1;
@@ -201,14 +472,20 @@ long long MemoryHandler<ValueType>::insert(ValueType* value)
 }
 
 
+template<typename ValueType>
+long long MemoryHandler<ValueType>::allocate()
+{
+    return insert(NULL);
+}
+
+
 template<typename ValueType>
 void MemoryHandler<ValueType>::remove(long long addr)
 {
     long currentPageIndex=addr>>12;
     int posInPage=addr & ((1<<12)-1);
-    int indexInPage=(posInPage-(PAGESIZE-PAGEREST))/header->valueSize;
+    int indexInPage=(posInPage-Layout::DATAOFFSET)/Layout::VALUESIZE;
     ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
-    char* dest=static_cast<char*>(currentPage->value)+ posInPage;   
     if (currentPage->firstEmptyRoom==-1)
     {
         currentPage->nextEmptyPage=header->valueEmpty;
@@ -220,91 +497,52 @@ void MemoryHandler<ValueType>::remove(long long addr)
     munmap(currentPage,sizeof(ValuePage));
 }
 
-
-
 template<typename ValueType>
-void* MemoryHandler<ValueType>::getAddr(long long addr)
+void MemoryHandler<ValueType>::removeBatch(long long* addr,int count)
 {
-    long currentPageIndex=addr>>12;
-    int posInPage=addr & ((1<<12)-1);
-    int indexInPage=(posInPage-(PAGESIZE-PAGEREST))/header->valueSize;
-    AddrCache* tmp;
-    tmp=valueCache;
-    while (tmp)
+    std::sort(addr,addr+count);
+    int i=0;
+    while (i<count)
     {
-        if (tmp->pageNum==currentPageIndex)
-	{
-	    tmp->invokeTime++;
-	    return tmp->firstAddr+(indexInPage)*header->valueSize;
-	}
-	tmp=tmp->next;
+        long currentPageIndex=addr[i]>>12;
+        ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
+        for (;i<count && (addr[i]>>12)==currentPageIndex;i++)
+        {
+            int indexInPage=((addr[i] & ((1<<12)-1))-Layout::DATAOFFSET)/Layout::VALUESIZE;
+            if (currentPage->firstEmptyRoom==-1)
+            {
+                currentPage->nextEmptyPage=header->valueEmpty;
+                header->valueEmpty=currentPageIndex;
+            }
+            if (currentPage->firstEmptyRoom==-1 || indexInPage<currentPage->firstEmptyRoom)
+                currentPage->firstEmptyRoom=indexInPage;
+            currentPage->clear(indexInPage);
+        }
+        munmap(currentPage,sizeof(ValuePage));
     }
+}
 
-    ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
-    AddrCache* newCache=new AddrCache;
-    newCache->pageNum=currentPageIndex;
-    newCache->invokeTime=1;
-    newCache->firstAddr=currentPage->value;
-    if (!valueCache) 
-    {
-        valueCache=newCache;
-    }
-    else 
-    {
-        newCache->prev=valueCache;
-        newCache->next=valueCache->next;
-	if (newCache->next) newCache->next->prev=newCache;
-	valueCache->next=newCache;
-    }
-    return currentPage->value+(indexInPage)*header->valueSize;
+template<typename ValueType>
+void MemoryHandler<ValueType>::reset()
+{
+    if (ftruncate(fd,PAGESIZE)==-1)
+        throw string("Memory Handler Error: file truncate failed!");
+    header->total=1;
+    header->valueEmpty=0;
 }
 
 
 
+template<typename ValueType>
+void* MemoryHandler<ValueType>::getAddr(long long addr)
+{
+    return pageCache.pin(addr>>12)+(addr & ((1<<12)-1));
+}
 
 template<typename ValueType>
 void MemoryHandler<ValueType>::unMapAddr(long long addr)
 {
-    long currentPageIndex=addr>>12;
-    AddrCache* tmp;
-    tmp=valueCache;
-    while (tmp)
-    {
-        if (tmp->pageNum==currentPageIndex)
-	{
-	    tmp->invokeTime--;
-	    if (tmp->invokeTime==0)
-	    {
-	        munmap((ValuePage*)(tmp->firstAddr-(PAGESIZE-PAGEREST)),sizeof(ValuePage));
-		if (tmp->prev && tmp->next)
-		{
-		    tmp->prev->next=tmp->next;
-		    tmp->next->prev=tmp->prev;
-		    delete tmp;
-		}
-		else if (tmp->prev)
-		{
-		    tmp->prev->next=NULL;
-		    tmp->prev=NULL;
-		    delete tmp;
-		}
-		else if (tmp->next)
-		{
-		    tmp->next->prev=NULL;
-		    valueCache=tmp->next;
-		    tmp->next=NULL;
-		    delete tmp;
-		}
-		else
-		{
-		    delete tmp;
-		    valueCache=NULL;
-		}
-		break;
-	    }
-	}
-	tmp=tmp->next;
-    }
+    pageCache.unpin(addr>>12);
 }
 
 
@@ -315,22 +553,24 @@ long MemoryHandler<ValueType>::getTotal()
     return header->total;
 }
 
+template<typename ValueType>
+long long MemoryHandler<ValueType>::getStamp()
+{
+    return header->stamp;
+}
 
+template<typename ValueType>
+void MemoryHandler<ValueType>::touch()
+{
+    header->stamp++;
+}
 
 template<typename ValueType>
-int MemoryHandler<ValueType>::compare(long long addr,const ValueType& value)
+int MemoryHandler<ValueType>::getMappedPages()
 {
-    long currentPageIndex=addr>>12;
-    int posInPage=addr & ((1<<12)-1);
-    int indexInPage=(posInPage-(PAGESIZE-PAGEREST))/header->valueSize;
-    ValuePage* currentPage=static_cast<ValuePage*>(mmap(NULL,sizeof(ValuePage),PROT_READ | PROT_WRITE, MAP_SHARED, fd, currentPageIndex<<12));
-    ValueType dest;
-    memcpy(&dest,(char*)(currentPage->value)+(indexInPage)*header->valueSize,header->valueSize);
-    munmap(currentPage,sizeof(ValuePage));
-    if (dest==value) return 0;
-    else if (dest<value) return -1;
-    else return 1;
+    return pageCache.getMappedPages();
 }
 
 
+
 #endif
@@ -0,0 +1,539 @@
+#ifndef _STRINGHANDLER_H_
+#define _STRINGHANDLER_H_
+
+#include "MemoryHandler.h"
+
+#define FREETHRESHOLD (PAGESIZE>>2)
+#define EXTENTSLOT ((1<<12)-1)
+
+
+struct StringRef
+{
+    const char* data;
+    int length;
+    StringRef():data(NULL),length(0){};
+    StringRef(const char* str,int len):data(str),length(len){};
+    StringRef(const char* str):data(str),length((int)strlen(str)){};
+    StringRef(const string& str):data(str.data()),length((int)str.size()){};
+    int compare(const StringRef& other) const
+    {
+        int check=memcmp(data,other.data,length<other.length?length:other.length);
+        if (check) return check;
+        return length-other.length;
+    }
+    string str() const { return string(data,length); }
+    friend bool operator<(const StringRef& left,const StringRef& right) { return left.compare(right)<0; }
+    friend bool operator==(const StringRef& left,const StringRef& right) { return left.compare(right)==0; }
+};
+
+template<typename KeyType>
+struct IsStringKey { enum { value=false }; };
+template<> struct IsStringKey<StringRef> { enum { value=true }; };
+template<> struct IsStringKey<string> { enum { value=true }; };
+template<> struct IsStringKey<const char*> { enum { value=true }; };
+template<> struct IsStringKey<char*> { enum { value=true }; };
+template<int N> struct IsStringKey<char[N]> { enum { value=true }; };
+
+
+class StringHandler
+{
+public:
+    StringHandler(const char* fileName);
+    ~StringHandler();
+    long long insert(const string* value);
+    long long insert(const StringRef& value);
+    long long update(long long addr,const string* value);
+    void remove(long long addr);
+    void removeBatch(long long* addr,int count);
+    void reset();
+    StringRef pin(long long addr);
+    void unMapAddr(long long addr);
+    string getValue(long long addr);
+    long long getLength(long long addr);
+    long long reserve(long long length);
+    int read(long long addr,long long offset,char* buffer,int length);
+    int write(long long addr,long long offset,const char* buffer,int length);
+    long getTotal();
+    int getMappedPages();
+private:
+    int fd;
+    char pageInitialize[PAGESIZE];
+    StringHandler(){};
+    StringHandler(const StringHandler&);
+    StringHandler& operator=(const StringHandler&);
+    struct Header
+    {
+        long total;
+	long currentPage;
+	long freePage;
+	long freeExtent;
+    };
+    Header* header;
+    PageCache pageCache;
+    struct Slot
+    {
+        unsigned short offset;
+	unsigned short length;
+    };
+    struct SlotPage
+    {
+        int slotNum;
+	int dataStart;
+	int deadBytes;
+	int nextFreePage;
+	int inFreeList;
+	Slot* slot()          { return (Slot*)((char*)this+sizeof(SlotPage)); }
+	int freeBytes()       { return dataStart-(int)sizeof(SlotPage)-slotNum*(int)sizeof(Slot); }
+	void initialize()
+	{
+	    slotNum=0;
+	    dataStart=PAGESIZE;
+	    deadBytes=0;
+	    nextFreePage=0;
+	    inFreeList=0;
+	}
+    };
+    struct ExtentPage
+    {
+        int pageCount;
+	long nextFree;
+	long long length;
+	char* data()           { return (char*)this+sizeof(ExtentPage); }
+	long long capacity()   { return (long long)pageCount*PAGESIZE-(long long)sizeof(ExtentPage); }
+    };
+    static int slotLimit() { return PAGESIZE-(int)sizeof(SlotPage)-(int)sizeof(Slot); }
+    void addPage()
+    {
+        ::write(fd, pageInitialize, PAGESIZE);
+        if (header)
+            header->total++;
+    }
+    int findSlot(SlotPage* page);
+    bool fits(SlotPage* page,int length);
+    void compact(SlotPage* page);
+    long long insertSlot(const StringRef& value);
+    long allocateExtent(int pageCount);
+    void freeExtent(long pageNum);
+    void linkExtent(long prev,long pageNum);
+    int transfer(long long addr,long long offset,char* buffer,int length,bool toFile);
+};
+
+
+
+inline StringHandler::StringHandler(const char* fileName)
+{
+    memset(pageInitialize,0,PAGESIZE);
+    header=NULL;
+    fd = open(fileName, O_RDWR | O_APPEND, S_IREAD | S_IWRITE);
+    if (fd == -1)
+    {
+        fd = open(fileName, O_RDWR | O_APPEND | O_CREAT, S_IREAD | S_IWRITE);
+        if (fd == -1)
+            throw string("String Handler Error: file open failed!");
+        addPage();
+    }
+    pageCache.setFile(fd);
+    header=static_cast<Header*>(mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (header->total == 0)
+    {
+        header->total = 1;
+        header->currentPage=0;
+        header->freePage=0;
+        header->freeExtent=0;
+    }
+}
+
+inline StringHandler::~StringHandler()
+{
+    munmap(header,sizeof(Header));
+    close(fd);
+}
+
+inline int StringHandler::findSlot(SlotPage* page)
+{
+    Slot* slot=page->slot();
+    for (int i=0;i<page->slotNum;i++)
+        if (slot[i].offset==0) return i;
+    return page->slotNum;
+}
+
+inline bool StringHandler::fits(SlotPage* page,int length)
+{
+    int need=length;
+    if (findSlot(page)==page->slotNum) need+=sizeof(Slot);
+    return page->freeBytes()+page->deadBytes>=need;
+}
+
+inline void StringHandler::compact(SlotPage* page)
+{
+    char buffer[PAGESIZE];
+    memcpy(buffer,page,PAGESIZE);
+    Slot* slot=page->slot();
+    int dataStart=PAGESIZE;
+    for (int i=0;i<page->slotNum;i++)
+    {
+        if (slot[i].offset==0) continue;
+	dataStart-=slot[i].length;
+	memcpy((char*)page+dataStart,buffer+slot[i].offset,slot[i].length);
+	slot[i].offset=dataStart;
+    }
+    page->dataStart=dataStart;
+    page->deadBytes=0;
+}
+
+inline long long StringHandler::insert(const string* value)
+{
+    return insert(StringRef(*value));
+}
+
+inline long long StringHandler::insert(const StringRef& value)
+{
+    if (value.length<=slotLimit())
+        return insertSlot(value);
+    long long addr=reserve(value.length);
+    write(addr,0,value.data,value.length);
+    return addr;
+}
+
+inline long long StringHandler::insertSlot(const StringRef& value)
+{
+    long pageNum=header->currentPage;
+    SlotPage* page=NULL;
+    if (pageNum)
+    {
+        page=(SlotPage*)(pageCache.pin(pageNum));
+	if (!fits(page,value.length))
+	{
+	    pageCache.unpin(pageNum);
+	    page=NULL;
+	}
+    }
+    while (!page && header->freePage)
+    {
+        pageNum=header->freePage;
+	page=(SlotPage*)(pageCache.pin(pageNum));
+	header->freePage=page->nextFreePage;
+	page->inFreeList=0;
+	if (!fits(page,value.length))
+	{
+	    pageCache.unpin(pageNum);
+	    page=NULL;
+	}
+    }
+    if (!page)
+    {
+        addPage();
+	pageNum=header->total-1;
+	page=(SlotPage*)(pageCache.pin(pageNum));
+	page->initialize();
+    }
+    header->currentPage=pageNum;
+    int index=findSlot(page);
+    int need=value.length+(index==page->slotNum?(int)sizeof(Slot):0);
+    if (page->freeBytes()<need)
+        compact(page);
+    if (index==page->slotNum) page->slotNum++;
+    page->dataStart-=value.length;
+    memcpy((char*)page+page->dataStart,value.data,value.length);
+    page->slot()[index].offset=page->dataStart;
+    page->slot()[index].length=value.length;
+    pageCache.unpin(pageNum);
+    return ((long long)pageNum<<12)|index;
+}
+
+inline long StringHandler::allocateExtent(int pageCount)
+{
+    long prev=0;
+    long pageNum=header->freeExtent;
+    while (pageNum)
+    {
+        ExtentPage* extent=(ExtentPage*)(pageCache.pin(pageNum));
+	long next=extent->nextFree;
+	int count=extent->pageCount;
+	pageCache.unpin(pageNum);
+	if (count>=pageCount)
+	{
+	    if (count>pageCount)
+	    {
+	        long rest=pageNum+pageCount;
+		extent=(ExtentPage*)(pageCache.pin(rest));
+		extent->pageCount=count-pageCount;
+		extent->nextFree=next;
+		pageCache.unpin(rest);
+		next=rest;
+	    }
+	    linkExtent(prev,next);
+	    return pageNum;
+	}
+	prev=pageNum;
+	pageNum=next;
+    }
+    pageNum=header->total;
+    for (int i=0;i<pageCount;i++)
+        addPage();
+    return pageNum;
+}
+
+inline void StringHandler::linkExtent(long prev,long pageNum)
+{
+    if (!prev)
+    {
+        header->freeExtent=pageNum;
+	return;
+    }
+    ((ExtentPage*)(pageCache.pin(prev)))->nextFree=pageNum;
+    pageCache.unpin(prev);
+}
+
+inline void StringHandler::freeExtent(long pageNum)
+{
+    int pageCount=((ExtentPage*)(pageCache.pin(pageNum)))->pageCount;
+    pageCache.unpin(pageNum);
+    long before=0,prev=0,next=header->freeExtent;
+    int prevCount=0;
+    while (next && next<pageNum)
+    {
+        ExtentPage* extent=(ExtentPage*)(pageCache.pin(next));
+	before=prev;
+	prev=next;
+	prevCount=extent->pageCount;
+	next=extent->nextFree;
+	pageCache.unpin(prev);
+    }
+    if (next && pageNum+pageCount==next)
+    {
+        ExtentPage* extent=(ExtentPage*)(pageCache.pin(next));
+	pageCount+=extent->pageCount;
+	long after=extent->nextFree;
+	pageCache.unpin(next);
+	next=after;
+    }
+    if (prev && prev+prevCount==pageNum)
+    {
+        pageNum=prev;
+	pageCount+=prevCount;
+	prev=before;
+    }
+    if (pageNum+pageCount==header->total && ftruncate(fd,(off_t)pageNum<<12)==0)
+    {
+        header->total=pageNum;
+	linkExtent(prev,next);
+	return;
+    }
+    ExtentPage* extent=(ExtentPage*)(pageCache.pin(pageNum));
+    extent->pageCount=pageCount;
+    extent->nextFree=next;
+    pageCache.unpin(pageNum);
+    linkExtent(prev,pageNum);
+}
+
+inline long long StringHandler::reserve(long long length)
+{
+    if (length<=slotLimit())
+        return insertSlot(StringRef(pageInitialize,(int)length));
+    int pageCount=(int)((length+(long long)sizeof(ExtentPage)+PAGESIZE-1)>>12);
+    long pageNum=allocateExtent(pageCount);
+    ExtentPage* extent=(ExtentPage*)(pageCache.pin(pageNum));
+    extent->pageCount=pageCount;
+    extent->nextFree=0;
+    extent->length=length;
+    pageCache.unpin(pageNum);
+    return ((long long)pageNum<<12)|EXTENTSLOT;
+}
+
+inline long long StringHandler::update(long long addr,const string* value)
+{
+    long pageNum=addr>>12;
+    int index=addr & ((1<<12)-1);
+    long long length=(long long)value->size();
+    if (index==EXTENTSLOT)
+    {
+        ExtentPage* extent=(ExtentPage*)(pageCache.pin(pageNum));
+	bool inPlace=length>slotLimit() && length<=extent->capacity();
+	if (inPlace) extent->length=length;
+	pageCache.unpin(pageNum);
+	if (inPlace)
+	{
+	    write(addr,0,value->data(),(int)length);
+	    return addr;
+	}
+    }
+    else
+    {
+        SlotPage* page=(SlotPage*)(pageCache.pin(pageNum));
+	Slot& slot=page->slot()[index];
+	bool inPlace=length<=slot.length;
+	if (inPlace)
+	{
+	    memcpy((char*)page+slot.offset,value->data(),(size_t)length);
+	    page->deadBytes+=slot.length-(int)length;
+	    slot.length=(unsigned short)length;
+	}
+	pageCache.unpin(pageNum);
+	if (inPlace) return addr;
+    }
+    remove(addr);
+    return insert(value);
+}
+
+inline void StringHandler::remove(long long addr)
+{
+    long pageNum=addr>>12;
+    int index=addr & ((1<<12)-1);
+    if (index==EXTENTSLOT)
+    {
+        freeExtent(pageNum);
+	return;
+    }
+    SlotPage* page=(SlotPage*)(pageCache.pin(pageNum));
+    Slot* slot=page->slot();
+    if (slot[index].offset==page->dataStart)
+        page->dataStart+=slot[index].length;
+    else
+        page->deadBytes+=slot[index].length;
+    slot[index].offset=0;
+    slot[index].length=0;
+    while (page->slotNum && slot[page->slotNum-1].offset==0)
+        page->slotNum--;
+    if (pageNum!=header->currentPage && !page->inFreeList && page->freeBytes()+page->deadBytes>=FREETHRESHOLD)
+    {
+        page->inFreeList=1;
+	page->nextFreePage=header->freePage;
+	header->freePage=pageNum;
+    }
+    pageCache.unpin(pageNum);
+}
+
+inline void StringHandler::removeBatch(long long* addr,int count)
+{
+    std::sort(addr,addr+count);
+    int i=0;
+    while (i<count)
+    {
+        long pageNum=addr[i]>>12;
+        pageCache.pin(pageNum);
+        for (;i<count && (addr[i]>>12)==pageNum;i++)
+            remove(addr[i]);
+        pageCache.unpin(pageNum);
+    }
+}
+
+inline void StringHandler::reset()
+{
+    if (ftruncate(fd,PAGESIZE)==-1)
+        throw string("String Handler Error: file truncate failed!");
+    header->total=1;
+    header->currentPage=0;
+    header->freePage=0;
+    header->freeExtent=0;
+}
+
+inline StringRef StringHandler::pin(long long addr)
+{
+    if ((addr & EXTENTSLOT)==EXTENTSLOT)
+    {
+        long pageNum=addr>>12;
+	int pageCount=((ExtentPage*)(pageCache.pin(pageNum)))->pageCount;
+	pageCache.unpin(pageNum);
+	ExtentPage* extent=(ExtentPage*)(pageCache.pin(pageNum,pageCount));
+	return StringRef(extent->data(),(int)extent->length);
+    }
+    char* page=pageCache.pin(addr>>12);
+    Slot& slot=((SlotPage*)page)->slot()[addr & ((1<<12)-1)];
+    return StringRef(page+slot.offset,slot.length);
+}
+
+inline void StringHandler::unMapAddr(long long addr)
+{
+    pageCache.unpin(addr>>12);
+}
+
+inline string StringHandler::getValue(long long addr)
+{
+    string value=pin(addr).str();
+    unMapAddr(addr);
+    return value;
+}
+
+inline long long StringHandler::getLength(long long addr)
+{
+    long pageNum=addr>>12;
+    char* page=pageCache.pin(pageNum);
+    long long length;
+    if ((addr & EXTENTSLOT)==EXTENTSLOT)
+        length=((ExtentPage*)page)->length;
+    else
+        length=((SlotPage*)page)->slot()[addr & EXTENTSLOT].length;
+    pageCache.unpin(pageNum);
+    return length;
+}
+
+inline int StringHandler::transfer(long long addr,long long offset,char* buffer,int length,bool toFile)
+{
+    long pageNum=addr>>12;
+    long long total=getLength(addr);
+    if (offset<0 || offset>=total || length<=0) return 0;
+    if (length>total-offset) length=(int)(total-offset);
+    if ((addr & EXTENTSLOT)!=EXTENTSLOT)
+    {
+        SlotPage* page=(SlotPage*)(pageCache.pin(pageNum));
+	char* data=(char*)page+page->slot()[addr & EXTENTSLOT].offset+offset;
+	if (toFile) memcpy(data,buffer,length);
+	else memcpy(buffer,data,length);
+	pageCache.unpin(pageNum);
+	return length;
+    }
+    long long begin=(long long)sizeof(ExtentPage)+offset;
+    long first=(long)(begin>>12);
+    long last=(long)((begin+length-1)>>12);
+    size_t mapSize=(size_t)(last-first+1)*PAGESIZE;
+    char* mapped=static_cast<char*>(mmap(NULL,mapSize,PROT_READ | PROT_WRITE,MAP_SHARED,fd,(long long)(pageNum+first)<<12));
+    char* data=mapped+(begin & (PAGESIZE-1));
+    if (toFile) memcpy(data,buffer,length);
+    else memcpy(buffer,data,length);
+    munmap(mapped,mapSize);
+    return length;
+}
+
+inline int StringHandler::read(long long addr,long long offset,char* buffer,int length)
+{
+    return transfer(addr,offset,buffer,length,false);
+}
+
+inline int StringHandler::write(long long addr,long long offset,const char* buffer,int length)
+{
+    return transfer(addr,offset,const_cast<char*>(buffer),length,true);
+}
+
+inline long StringHandler::getTotal()
+{
+    return header->total;
+}
+
+inline int StringHandler::getMappedPages()
+{
+    return pageCache.getMappedPages();
+}
+
+
+class StringGuard
+{
+public:
+    StringGuard(StringHandler* stringHandler,long long address)
+        :handler(stringHandler),addr(address)
+    {
+        value=handler->pin(addr);
+    }
+    ~StringGuard() { handler->unMapAddr(addr); }
+    const StringRef& operator*() const { return value; }
+    const StringRef* operator->() const { return &value; }
+private:
+    StringHandler* handler;
+    long long addr;
+    StringRef value;
+    StringGuard(const StringGuard&);
+    StringGuard& operator=(const StringGuard&);
+};
+
+
+#endif
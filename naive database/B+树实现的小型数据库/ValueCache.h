@@ -0,0 +1,288 @@
+#ifndef _VALUECACHE_H_
+#define _VALUECACHE_H_
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <string>
+using namespace std;
+
+#define CACHESHARDS (16)
+#define CACHEENTRYOVERHEAD (64)
+#define SKETCHROWS (4)
+#define SKETCHMAX (15)
+
+
+template<typename T>
+struct CacheCost
+{
+    static long long of(const T& value) { return sizeof(T); }
+};
+
+template<>
+struct CacheCost<string>
+{
+    static long long of(const string& value) { return sizeof(string)+(long long)value.size(); }
+};
+
+struct CacheStats
+{
+    long long hits;
+    long long misses;
+    long long admitted;
+    long long rejected;
+    long long evicted;
+    long long bytes;
+    CacheStats():hits(0),misses(0),admitted(0),rejected(0),evicted(0),bytes(0){};
+    double hitRate() const { return hits+misses?(double)hits/(hits+misses):0; }
+};
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+class ValueCache
+{
+public:
+    ValueCache(long long budget);
+    bool get(const KeyType& key,ValueType& value);
+    void admit(const KeyType& key,const ValueType& value);
+    void erase(const KeyType& key);
+    template<typename Predicate>
+    void eraseIf(Predicate predicate);
+    void clear();
+    CacheStats getStats();
+    void resetStats();
+private:
+    struct Entry
+    {
+        KeyType key;
+        ValueType value;
+        long long cost;
+        Entry(const KeyType& k,const ValueType& v,long long c):key(k),value(v),cost(c){};
+    };
+    struct Hasher
+    {
+        size_t operator()(const KeyType& key) const { return (size_t)Hash::hash(key); }
+    };
+    typedef list<Entry> EntryList;
+    typedef unordered_map<KeyType,typename EntryList::iterator,Hasher,Equal> EntryMap;
+    struct Shard
+    {
+        EntryList entries;
+        EntryMap index;
+        vector<unsigned char> sketch;
+        long long budget;
+        long long bytes;
+        long long samples;
+        long long sampleLimit;
+        CacheStats stats;
+    };
+    Shard shards[CACHESHARDS];
+    ValueCache();
+    ValueCache(const ValueCache&);
+    ValueCache& operator=(const ValueCache&);
+    Shard& shardOf(unsigned long long hash) { return shards[hash & (CACHESHARDS-1)]; }
+    void record(Shard& shard,unsigned long long hash);
+    int frequency(Shard& shard,unsigned long long hash);
+    void evict(Shard& shard,typename EntryList::iterator position);
+};
+
+
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+ValueCache<KeyType,ValueType,Hash,Equal>::ValueCache(long long budget)
+{
+    long long share=budget/CACHESHARDS;
+    long long slots=share/(CACHEENTRYOVERHEAD+sizeof(KeyType)+sizeof(ValueType))+1;
+    long long width=64;
+    while (width<slots)
+        width<<=1;
+    for (int i=0;i<CACHESHARDS;i++)
+    {
+        shards[i].sketch.assign((size_t)(width*SKETCHROWS),0);
+        shards[i].budget=share;
+        shards[i].bytes=0;
+        shards[i].samples=0;
+        shards[i].sampleLimit=width*10;
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::record(Shard& shard,unsigned long long hash)
+{
+    long long width=(long long)shard.sketch.size()/SKETCHROWS;
+    unsigned long long step=(hash>>32) | 1;
+    for (int i=0;i<SKETCHROWS;i++)
+    {
+        unsigned char& counter=shard.sketch[(size_t)(i*width+(long long)((hash+i*step)>>4 & (width-1)))];
+        if (counter<SKETCHMAX)
+            counter++;
+    }
+    if (++shard.samples<shard.sampleLimit)
+        return;
+    for (size_t i=0;i<shard.sketch.size();i++)
+        shard.sketch[i]>>=1;
+    shard.samples>>=1;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+int ValueCache<KeyType,ValueType,Hash,Equal>::frequency(Shard& shard,unsigned long long hash)
+{
+    long long width=(long long)shard.sketch.size()/SKETCHROWS;
+    unsigned long long step=(hash>>32) | 1;
+    int result=SKETCHMAX;
+    for (int i=0;i<SKETCHROWS;i++)
+    {
+        int counter=shard.sketch[(size_t)(i*width+(long long)((hash+i*step)>>4 & (width-1)))];
+        if (counter<result)
+            result=counter;
+    }
+    return result;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+bool ValueCache<KeyType,ValueType,Hash,Equal>::get(const KeyType& key,ValueType& value)
+{
+    unsigned long long hash=Hash::hash(key);
+    Shard& shard=shardOf(hash);
+    record(shard,hash);
+    typename EntryMap::iterator found=shard.index.find(key);
+    if (found==shard.index.end())
+    {
+        shard.stats.misses++;
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(),shard.entries,found->second);
+    value=found->second->value;
+    shard.stats.hits++;
+    return true;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::admit(const KeyType& key,const ValueType& value)
+{
+    unsigned long long hash=Hash::hash(key);
+    Shard& shard=shardOf(hash);
+    if (shard.index.count(key))
+        return;
+    long long cost=CACHEENTRYOVERHEAD+CacheCost<KeyType>::of(key)+CacheCost<ValueType>::of(value);
+    if (cost>shard.budget)
+    {
+        shard.stats.rejected++;
+        return;
+    }
+    if (shard.bytes+cost>shard.budget)
+    {
+        int candidate=frequency(shard,hash);
+        long long freed=0;
+        typename EntryList::iterator victim=shard.entries.end();
+        while (shard.bytes-freed+cost>shard.budget)
+        {
+            --victim;
+            if (frequency(shard,Hash::hash(victim->key))>=candidate)
+            {
+                shard.stats.rejected++;
+                return;
+            }
+            freed+=victim->cost;
+        }
+        while (victim!=shard.entries.end())
+            evict(shard,victim++);
+    }
+    shard.entries.push_front(Entry(key,value,cost));
+    shard.index[key]=shard.entries.begin();
+    shard.bytes+=cost;
+    shard.stats.admitted++;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::evict(Shard& shard,typename EntryList::iterator position)
+{
+    shard.bytes-=position->cost;
+    shard.index.erase(position->key);
+    shard.entries.erase(position);
+    shard.stats.evicted++;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::erase(const KeyType& key)
+{
+    Shard& shard=shardOf(Hash::hash(key));
+    typename EntryMap::iterator found=shard.index.find(key);
+    if (found==shard.index.end())
+        return;
+    shard.bytes-=found->second->cost;
+    shard.entries.erase(found->second);
+    shard.index.erase(found);
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+template<typename Predicate>
+void ValueCache<KeyType,ValueType,Hash,Equal>::eraseIf(Predicate predicate)
+{
+    for (int i=0;i<CACHESHARDS;i++)
+    {
+        typename EntryList::iterator position=shards[i].entries.begin();
+        while (position!=shards[i].entries.end())
+        {
+            if (!predicate(position->key))
+            {
+                ++position;
+                continue;
+            }
+            shards[i].bytes-=position->cost;
+            shards[i].index.erase(position->key);
+            position=shards[i].entries.erase(position);
+        }
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::clear()
+{
+    for (int i=0;i<CACHESHARDS;i++)
+    {
+        shards[i].entries.clear();
+        shards[i].index.clear();
+        shards[i].bytes=0;
+    }
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+CacheStats ValueCache<KeyType,ValueType,Hash,Equal>::getStats()
+{
+    CacheStats total;
+    for (int i=0;i<CACHESHARDS;i++)
+    {
+        total.hits+=shards[i].stats.hits;
+        total.misses+=shards[i].stats.misses;
+        total.admitted+=shards[i].stats.admitted;
+        total.rejected+=shards[i].stats.rejected;
+        total.evicted+=shards[i].stats.evicted;
+        total.bytes+=shards[i].bytes;
+    }
+    return total;
+}
+
+template<typename KeyType,typename ValueType,typename Hash,typename Equal>
+void ValueCache<KeyType,ValueType,Hash,Equal>::resetStats()
+{
+    for (int i=0;i<CACHESHARDS;i++)
+        shards[i].stats=CacheStats();
+}
+
+template<typename KeyType,typename ValueType>
+class DisabledCache
+{
+public:
+    DisabledCache(long long budget){};
+    bool get(const KeyType& key,ValueType& value)         { return false; }
+    void admit(const KeyType& key,const ValueType& value) {}
+    void erase(const KeyType& key)                        {}
+    template<typename Predicate>
+    void eraseIf(Predicate predicate)                     {}
+    void clear()                                          {}
+    CacheStats getStats()                                 { return CacheStats(); }
+    void resetStats()                                     {}
+};
+
+
+#endif
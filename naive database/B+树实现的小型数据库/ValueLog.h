@@ -0,0 +1,212 @@
+#ifndef _VALUELOG_H_
+#define _VALUELOG_H_
+
+#include "MemoryHandler.h"
+
+
+template<typename ValueType>
+class ValueLog
+{
+public:
+    ValueLog(const char* fileName);
+    ~ValueLog();
+    long long append(long long keyAddr,const ValueType* value);
+    void remove(long long addr);
+    void removeBatch(long long* addr,int count);
+    bool isLive(long long addr);
+    ValueType getValue(long long addr);
+    long long getKeyAddr(long long addr);
+    long long next(long long addr);
+    long long getHead()           { return head; }
+    long long getTail()           { return header->tail; }
+    void truncate(long long tail);
+    void reset();
+    int getMappedPages()          { return pageCache.getMappedPages(); }
+private:
+    struct Header
+    {
+        long long tail;
+	int recordSize;
+	long long head;
+    };
+    struct Record
+    {
+        long long keyAddr;
+	int dead;
+	ValueType value;
+    };
+    int fd;
+    long long head;
+    long tailNum;
+    char* tailPage;
+    Header* header;
+    PageCache pageCache;
+    ValueLog(){};
+    ValueLog(const ValueLog&);
+    ValueLog& operator=(const ValueLog&);
+    Record* pin(long long addr);
+    void unpin(long long addr);
+    void addPage();
+};
+
+
+
+template<typename ValueType>
+ValueLog<ValueType>::ValueLog(const char* fileName)
+{
+    if (sizeof(Record)>PAGESIZE)
+        throw string("Value Log Error: Value Type Size Too Large!");
+    fd = open(fileName, O_RDWR, S_IREAD | S_IWRITE);
+    if (fd == -1)
+    {
+        fd = open(fileName, O_RDWR | O_CREAT, S_IREAD | S_IWRITE);
+        if (fd == -1 || ftruncate(fd, PAGESIZE) == -1)
+            throw string("Value Log Error: file open failed!");
+    }
+    pageCache.setFile(fd);
+    header=static_cast<Header*>(mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (header->tail == 0)
+    {
+        header->tail = PAGESIZE;
+        header->recordSize = sizeof(Record);
+        header->head = PAGESIZE;
+    }
+    else if (header->recordSize != sizeof(Record))
+        throw string("Value Log Error: Value Type Size Mismatch!");
+    head=header->head;
+    if (head>lseek(fd,0,SEEK_END))
+        throw string("Value Log Error: log file shorter than its head!");
+    tailNum=0;
+    tailPage=NULL;
+    if (head & (PAGESIZE-1))
+    {
+        tailNum=(long)(head>>12);
+        tailPage=pageCache.pin(tailNum);
+    }
+}
+
+template<typename ValueType>
+ValueLog<ValueType>::~ValueLog()
+{
+    if (tailPage)
+        pageCache.unpin(tailNum);
+    munmap(header,sizeof(Header));
+    close(fd);
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::addPage()
+{
+    if (tailPage)
+        pageCache.unpin(tailNum);
+    tailPage=NULL;
+    if (ftruncate(fd,head+PAGESIZE)==-1)
+        throw string("Value Log Error: file extend failed!");
+    tailNum=(long)(head>>12);
+    tailPage=pageCache.pin(tailNum);
+}
+
+template<typename ValueType>
+long long ValueLog<ValueType>::append(long long keyAddr,const ValueType* value)
+{
+    if (PAGESIZE-(head & (PAGESIZE-1))<(long long)sizeof(Record))
+        head=(head+PAGESIZE-1) & ~(long long)(PAGESIZE-1);
+    if (!(head & (PAGESIZE-1)))
+        addPage();
+    long long addr=head;
+    Record* record=(Record*)(tailPage+(addr & (PAGESIZE-1)));
+    record->keyAddr=keyAddr;
+    record->dead=0;
+    memcpy(&record->value,value,sizeof(ValueType));
+    head+=sizeof(Record);
+    header->head=head;
+    return addr;
+}
+
+template<typename ValueType>
+typename ValueLog<ValueType>::Record* ValueLog<ValueType>::pin(long long addr)
+{
+    return (Record*)(pageCache.pin((long)(addr>>12))+(addr & (PAGESIZE-1)));
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::unpin(long long addr)
+{
+    pageCache.unpin((long)(addr>>12));
+}
+
+template<typename ValueType>
+ValueType ValueLog<ValueType>::getValue(long long addr)
+{
+    ValueType value;
+    memcpy(&value,&pin(addr)->value,sizeof(ValueType));
+    unpin(addr);
+    return value;
+}
+
+template<typename ValueType>
+long long ValueLog<ValueType>::getKeyAddr(long long addr)
+{
+    long long keyAddr=pin(addr)->keyAddr;
+    unpin(addr);
+    return keyAddr;
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::remove(long long addr)
+{
+    pin(addr)->dead=1;
+    unpin(addr);
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::removeBatch(long long* addr,int count)
+{
+    for (int i=0;i<count;i++)
+        remove(addr[i]);
+}
+
+template<typename ValueType>
+bool ValueLog<ValueType>::isLive(long long addr)
+{
+    bool live=!pin(addr)->dead;
+    unpin(addr);
+    return live;
+}
+
+template<typename ValueType>
+long long ValueLog<ValueType>::next(long long addr)
+{
+    addr+=sizeof(Record);
+    if (PAGESIZE-(addr & (PAGESIZE-1))<(long long)sizeof(Record))
+        addr=(addr+PAGESIZE-1) & ~(long long)(PAGESIZE-1);
+    return addr<head?addr:head;
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::truncate(long long tail)
+{
+    long long first=header->tail & ~(long long)(PAGESIZE-1);
+    long long last=tail & ~(long long)(PAGESIZE-1);
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (last>first)
+        fallocate(fd,FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,first,last-first);
+#endif
+    header->tail=tail;
+}
+
+template<typename ValueType>
+void ValueLog<ValueType>::reset()
+{
+    if (tailPage)
+        pageCache.unpin(tailNum);
+    tailPage=NULL;
+    if (ftruncate(fd,PAGESIZE)==-1)
+        throw string("Value Log Error: file truncate failed!");
+    header->tail=PAGESIZE;
+    header->head=PAGESIZE;
+    head=PAGESIZE;
+}
+
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _WRITEBATCH_H_
+#define _WRITEBATCH_H_
+
+#include <vector>
+using namespace std;
+
+
+template<typename KeyType,typename ValueType>
+class WriteBatch
+{
+public:
+    enum Operation { PUT, UPDATE, REMOVE };
+    struct Entry
+    {
+        Operation op;
+        KeyType key;
+        ValueType value;
+        Entry(Operation operation,const KeyType& k,const ValueType& v):op(operation),key(k),value(v){};
+    };
+    WriteBatch(){};
+    void put(const KeyType& key,const ValueType& value);
+    void update(const KeyType& key,const ValueType& value);
+    void remove(const KeyType& key);
+    void clear()                        { entries.clear(); }
+    int size() const                    { return (int)entries.size(); }
+    const Entry& get(int i) const       { return entries[i]; }
+private:
+    vector<Entry> entries;
+    WriteBatch(const WriteBatch&);
+    WriteBatch& operator=(const WriteBatch&);
+};
+
+
+
+template<typename KeyType,typename ValueType>
+void WriteBatch<KeyType,ValueType>::put(const KeyType& key,const ValueType& value)
+{
+    entries.push_back(Entry(PUT,key,value));
+}
+
+template<typename KeyType,typename ValueType>
+void WriteBatch<KeyType,ValueType>::update(const KeyType& key,const ValueType& value)
+{
+    entries.push_back(Entry(UPDATE,key,value));
+}
+
+template<typename KeyType,typename ValueType>
+void WriteBatch<KeyType,ValueType>::remove(const KeyType& key)
+{
+    entries.push_back(Entry(REMOVE,key,ValueType()));
+}
+
+
+#endif
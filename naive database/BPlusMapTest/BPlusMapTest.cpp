@@ -0,0 +1,405 @@
+#include "BPlusTree.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+#define FUZZNUM (20000)
+#define FUZZRANGE (2000)
+using namespace std;
+
+const char* indexName = "testIndex.dat";
+const char* keyName = "testKey.dat";
+const char* dataName = "testValue.dat";
+const char* filterName = "testFilter.dat";
+
+struct PaddedKey
+{
+	char tag;
+	int id;
+	bool operator<(const PaddedKey& other) const { return id < other.id; }
+};
+
+static int failures = 0;
+
+void check(bool condition, const char* test, const char* what)
+{
+	if (condition) return;
+	printf("FAIL %-20s %s\n", test, what);
+	failures++;
+}
+
+void removeFiles()
+{
+	unlink(indexName);
+	unlink(keyName);
+	unlink(dataName);
+	unlink(filterName);
+}
+
+template<typename Map>
+bool sameContents(Map& tree, map<int, long long>& reference)
+{
+	if (tree.size() != (long long)reference.size()) return false;
+	for (map<int, long long>::iterator it = reference.begin(); it != reference.end(); ++it)
+	{
+		long long value;
+		if (!tree.tryGet(it->first, value) || value != it->second) return false;
+	}
+	return true;
+}
+
+void testMergeThresholds()
+{
+	for (int threshold = 0; threshold <= BTORDER; threshold++)
+	{
+		removeFiles();
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		bool valid = threshold <= ((BTORDER + 1) >> 1);
+		bool thrown = false;
+		try { tree.setMergeThreshold(threshold); }
+		catch (string) { thrown = true; }
+		check(thrown != valid, "mergeThreshold", "threshold validation");
+		map<int, long long> reference;
+		srand(threshold + 1);
+		for (int i = 0; i < FUZZNUM; i++)
+		{
+			int key = rand() % FUZZRANGE;
+			if (rand() % 2)
+			{
+				if (!reference.count(key)) tree.insert(key, (long long)i);
+				reference.insert(make_pair(key, (long long)i));
+			}
+			else if (reference.count(key))
+			{
+				tree.remove(key);
+				reference.erase(key);
+			}
+		}
+		check(sameContents(tree, reference), "mergeThreshold", "contents after fuzz");
+		tree.rebalance(FUZZNUM);
+		check(sameContents(tree, reference), "mergeThreshold", "contents after rebalance");
+	}
+	removeFiles();
+}
+
+void testFilterStamp()
+{
+	removeFiles();
+	{
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		tree.enableFilter(filterName, 0);
+		for (int i = 0; i < 100; i++) tree.insert(i, (long long)i);
+	}
+	{
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		tree.remove(5);
+		tree.insert(1000, 1000LL);
+	}
+	{
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		tree.enableFilter(filterName, 0);
+		check(tree.contains(1000), "filterStamp", "key inserted without filter");
+		check(!tree.contains(5), "filterStamp", "key removed without filter");
+		long long value = 0;
+		check(tree.tryGet(1000, value) && value == 1000, "filterStamp", "value inserted without filter");
+		tree.clear();
+		string error;
+		try { tree.get(1); }
+		catch (string e) { error = e; }
+		check(error == "BPLUSMAP EMPTY", "filterStamp", "empty map error");
+	}
+	removeFiles();
+}
+
+void testFilterEqualKeys()
+{
+	removeFiles();
+	{
+		BPlusMap<double, long long> tree(indexName, keyName, dataName);
+		tree.insert(0.0, 1LL);
+		tree.enableFilter(filterName, 0);
+		check(tree.contains(-0.0), "filterEqualKeys", "negative zero after rebuild");
+		tree.remove(-0.0);
+		tree.insert(-0.0, 2LL);
+		check(tree.contains(0.0), "filterEqualKeys", "positive zero after insert");
+	}
+	removeFiles();
+	{
+		BPlusMap<PaddedKey, long long> tree(indexName, keyName, dataName);
+		bool thrown = false;
+		try { tree.enableFilter(filterName, 0); }
+		catch (string) { thrown = true; }
+		check(thrown, "filterEqualKeys", "padded key rejected");
+	}
+	removeFiles();
+}
+
+void testCacheEqualKeys()
+{
+	removeFiles();
+	{
+		BPlusMap<double, long long> tree(indexName, keyName, dataName);
+		tree.enableCache(1 << 20);
+		tree.insert(0.0, 1LL);
+		tree.get(0.0);
+		tree.update(-0.0, 2LL);
+		check(tree.get(0.0) == 2, "cacheEqualKeys", "update through negative zero");
+		tree.remove(-0.0);
+		long long value = 0;
+		check(!tree.tryGet(0.0, value), "cacheEqualKeys", "remove through negative zero");
+	}
+	removeFiles();
+	{
+		BPlusMap<PaddedKey, long long> tree(indexName, keyName, dataName);
+		bool thrown = false;
+		try { tree.enableCache(1 << 20); }
+		catch (string) { thrown = true; }
+		check(thrown, "cacheEqualKeys", "padded key rejected");
+	}
+	removeFiles();
+}
+
+void testCacheNegativeValues()
+{
+	removeFiles();
+	{
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		tree.enableCache(1 << 20);
+		tree.insertOrAssign(1, 5LL);
+		tree.get(1);
+		tree.insertOrAssign(1, -1LL);
+		check(tree.get(1) == -1, "cacheNegativeValues", "assign -1 over cached value");
+		tree.insertOrAssign(2, -1LL);
+		tree.get(2);
+		tree.upsert(2, 0LL, [](long long& value) { value = 7; });
+		check(tree.get(2) == 7, "cacheNegativeValues", "upsert over cached -1");
+	}
+	removeFiles();
+}
+
+void testAggregateNegativeValues()
+{
+	removeFiles();
+	{
+		BPlusMap<int, long long, KeyCompare, ValueStorage<long long>, SumAggregate<long long> > tree(indexName, keyName, dataName);
+		map<int, long long> reference;
+		srand(46);
+		for (int i = 0; i < FUZZNUM; i++)
+		{
+			int key = rand() % FUZZRANGE;
+			long long value = rand() % 5 - 3;
+			if (rand() % 2)
+			{
+				tree.insertOrAssign(key, value);
+				reference[key] = value;
+			}
+			else
+			{
+				tree.upsert(key, value, [](long long& stored) { stored = -1 - stored; });
+				if (reference.count(key)) reference[key] = -1 - reference[key];
+				else reference[key] = value;
+			}
+		}
+		long long total = 0;
+		for (map<int, long long>::iterator it = reference.begin(); it != reference.end(); ++it)
+			total += it->second;
+		check(sameContents(tree, reference), "aggregateNegative", "contents after fuzz");
+		check(tree.aggregate(0, FUZZRANGE) == total, "aggregateNegative", "sum with -1 values");
+		tree.insertOrAssign(FUZZRANGE, 5LL);
+		tree.insertOrAssign(FUZZRANGE, -1LL);
+		check(tree.aggregate(FUZZRANGE, FUZZRANGE) == -1, "aggregateNegative", "assign -1 over 5");
+		tree.upsert(FUZZRANGE, 0LL, [](long long& stored) { stored = -1; });
+		check(tree.aggregate(0, FUZZRANGE) == total - 1, "aggregateNegative", "upsert to -1");
+	}
+	removeFiles();
+}
+
+void testLogCollectGarbage()
+{
+	removeFiles();
+	{
+		BPlusMap<int, long long, KeyCompare, LogStorage<long long> > tree(indexName, keyName, dataName);
+		for (int i = 0; i < 100; i++) tree.insert(i, (long long)i);
+		for (int i = 0; i < 100; i += 2) tree.update(i, (long long)-i);
+		int moved = tree.collectGarbage(FUZZNUM);
+		check(moved == 100, "logCollectGarbage", "each live record moved once");
+		check(tree.collectGarbage(FUZZNUM) == 100, "logCollectGarbage", "second pass moves the same records");
+		bool same = true;
+		for (int i = 0; i < 100; i++) same = same && tree.get(i) == (i % 2 ? i : -i);
+		check(same, "logCollectGarbage", "values after collection");
+	}
+	removeFiles();
+}
+
+void testLogDeadKeys()
+{
+	removeFiles();
+	{
+		BPlusMap<string, long long, KeyCompare, LogStorage<long long> > tree(indexName, keyName, dataName);
+		char key[16];
+		for (int round = 0; round < 4; round++)
+		{
+			for (int i = 0; i < 200; i++)
+			{
+				sprintf(key, "k%d", round * 1000 + i);
+				tree.insert(string(key), (long long)i);
+			}
+			for (int i = 0; i < 200; i++)
+			{
+				sprintf(key, "k%d", round * 1000 + i);
+				tree.remove(string(key));
+			}
+			tree.insert(string(PAGESIZE - 600, (char)(0x7f - round)), (long long)round);
+		}
+		check(tree.collectGarbage(FUZZNUM) == 4, "logDeadKeys", "only live records moved");
+		bool same = true;
+		for (int round = 0; round < 4; round++) same = same && tree.get(string(PAGESIZE - 600, (char)(0x7f - round))) == round;
+		check(same, "logDeadKeys", "values after collection");
+	}
+	removeFiles();
+}
+
+void testLogWithoutClose()
+{
+	typedef BPlusMap<int, long long, KeyCompare, LogStorage<long long> > LogMap;
+	removeFiles();
+	LogMap* abandoned = new LogMap(indexName, keyName, dataName);
+	for (int i = 0; i < 10; i++) abandoned->insert(i, (long long)i + 100);
+	{
+		LogMap tree(indexName, keyName, dataName);
+		bool same = tree.size() == 10;
+		for (int i = 0; i < 10; i++) same = same && tree.get(i) == i + 100;
+		check(same, "logWithoutClose", "values visible before the log is closed");
+	}
+	removeFiles();
+}
+
+void testBatchThenAppend()
+{
+	bool same = true;
+	for (int seed = 0; seed < 200 && same; seed++)
+	{
+		removeFiles();
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		map<int, long long> reference;
+		srand(seed);
+		int next = 0;
+		for (int round = 0; round < 10; round++)
+		{
+			WriteBatch<int, long long> batch;
+			for (int i = 0; i < 20; i++)
+			{
+				int key = rand() % (next + 1);
+				if (reference.count(key) && rand() % 2)
+				{
+					batch.remove(key);
+					reference.erase(key);
+				}
+			}
+			batch.put(next, (long long)next);
+			reference[next] = next;
+			next++;
+			tree.apply(batch);
+			for (int i = 0; i < 20; i++, next++)
+			{
+				tree.insert(next, (long long)next);
+				reference[next] = next;
+			}
+		}
+		same = sameContents(tree, reference);
+	}
+	check(same, "batchThenAppend", "appends after a batch ending in an append");
+	removeFiles();
+}
+
+void testPinnedLevels()
+{
+	int levels[] = { 1, 12, 40, 1 << 20 };
+	for (int n = 0; n < 4; n++)
+	{
+		removeFiles();
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		map<int, long long> reference;
+		tree.pinUpperLevels(levels[n]);
+		srand(n + 49);
+		for (int i = 0; i < FUZZNUM; i++)
+		{
+			int key = rand() % FUZZRANGE;
+			if (rand() % 3)
+			{
+				if (!reference.count(key)) tree.insert(key, (long long)i);
+				reference.insert(make_pair(key, (long long)i));
+			}
+			else if (reference.count(key))
+			{
+				tree.remove(key);
+				reference.erase(key);
+			}
+		}
+		check(sameContents(tree, reference), "pinnedLevels", "contents with pinned levels");
+	}
+	removeFiles();
+}
+
+long long fileSize(const char* fileName)
+{
+	FILE* file = fopen(fileName, "rb");
+	if (!file) return 0;
+	fseek(file, 0, SEEK_END);
+	long long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+void testExtentGrowth()
+{
+	removeFiles();
+	{
+		BPlusMap<int, string> tree(indexName, keyName, dataName);
+		vector<long long> sizes(100, 0);
+		long long live = 0, peak = 0;
+		srand(34);
+		for (int i = 0; i < 2000; i++)
+		{
+			int key = rand() % 100;
+			int length = rand() % 300000 + 1;
+			if (sizes[key] && rand() % 3 == 0)
+			{
+				tree.remove(key);
+				live -= sizes[key];
+				sizes[key] = 0;
+				continue;
+			}
+			string value(length, (char)('a' + key % 26));
+			if (sizes[key]) tree.update(key, value);
+			else tree.insert(key, value);
+			live += length - sizes[key];
+			sizes[key] = length;
+			if (live > peak) peak = live;
+		}
+		check(fileSize(dataName) <= 2 * peak, "extentGrowth", "data file within twice the peak live bytes");
+		bool same = true;
+		for (int key = 0; key < 100; key++)
+			if (sizes[key]) same = same && tree.get(key) == string((size_t)sizes[key], (char)('a' + key % 26));
+		check(same, "extentGrowth", "values after churn");
+	}
+	removeFiles();
+}
+
+int main()
+{
+	testMergeThresholds();
+	testFilterStamp();
+	testFilterEqualKeys();
+	testCacheEqualKeys();
+	testCacheNegativeValues();
+	testAggregateNegativeValues();
+	testLogCollectGarbage();
+	testLogDeadKeys();
+	testLogWithoutClose();
+	testBatchThenAppend();
+	testPinnedLevels();
+	testExtentGrowth();
+	printf("%s (%d failures)\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+#include "MemoryHandler.h"
+#include "BPlusTree.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#define BENCHNUM (20000)
+#define EVICTSIZE (64<<20)
+#define TREENUM (60000)
+using namespace std;
+
+template<int Size>
+struct Blob
+{
+	char data[Size];
+	bool operator==(const Blob& other) const { return memcmp(data, other.data, Size) == 0; }
+	bool operator<(const Blob& other) const { return memcmp(data, other.data, Size)<0; }
+};
+
+enum Occupancy { FULL, HALF, SPARSE };
+const char* occupancyName[] = { "full", "half", "sparse" };
+
+static char* evictBuffer = NULL;
+
+void evictCache()
+{
+	if (!evictBuffer) evictBuffer = new char[EVICTSIZE];
+	for (int i = 0; i < EVICTSIZE; i += 64)
+		evictBuffer[i]++;
+}
+
+double nowNs()
+{
+	return (double)chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+void report(const char* op, int size, Occupancy occ, const char* cache, double total, int count)
+{
+	printf("%-10s size=%-5d occupancy=%-6s %-4s %10.1f ns/op\n", op, size, occupancyName[occ], cache, total / count);
+}
+
+template<typename ValueType>
+void fill(MemoryHandler<ValueType>& handler, vector<long long>& addr)
+{
+	ValueType value;
+	memset(&value, 0, sizeof(ValueType));
+	for (int i = 0; i < BENCHNUM; i++)
+	{
+		memcpy(&value, &i, sizeof(int) < sizeof(ValueType) ? sizeof(int) : sizeof(ValueType));
+		addr.push_back(handler.insert(&value));
+	}
+}
+
+template<typename ValueType>
+void thin(MemoryHandler<ValueType>& handler, vector<long long>& addr, Occupancy occ)
+{
+	if (occ == FULL) return;
+	int keep = occ == HALF ? 2 : 8;
+	vector<long long> live;
+	for (int i = 0; i < (int)addr.size(); i++)
+	{
+		if (i%keep == 0) live.push_back(addr[i]);
+		else handler.remove(addr[i]);
+	}
+	addr.swap(live);
+}
+
+template<typename ValueType, typename Op>
+void measure(const char* name, Occupancy occ, vector<long long>& addr, Op op)
+{
+	vector<long long> order(addr);
+	random_shuffle(order.begin(), order.end());
+	evictCache();
+	double start = nowNs();
+	for (int i = 0; i < (int)order.size(); i++) op(order[i]);
+	report(name, sizeof(ValueType), occ, "cold", nowNs() - start, (int)order.size());
+
+	int warmSet = order.size() < 64 ? (int)order.size() : 64;
+	for (int i = 0; i < warmSet; i++) op(order[i]);
+	int rounds = (int)order.size() / warmSet;
+	start = nowNs();
+	for (int r = 0; r < rounds; r++)
+		for (int i = 0; i < warmSet; i++) op(order[i]);
+	report(name, sizeof(ValueType), occ, "warm", nowNs() - start, rounds*warmSet);
+}
+
+template<typename ValueType>
+void runSuite(Occupancy occ)
+{
+	const char* fileName = "benchData.dat";
+	unlink(fileName);
+	ValueType value;
+	memset(&value, 0x5A, sizeof(ValueType));
+	vector<long long> addr;
+	{
+		MemoryHandler<ValueType> handler(fileName);
+		evictCache();
+		double start = nowNs();
+		fill(handler, addr);
+		if (occ == FULL)
+			report("insert", sizeof(ValueType), occ, "cold", nowNs() - start, BENCHNUM);
+		else
+		{
+			start = nowNs();
+			thin(handler, addr, occ);
+			report("thin", sizeof(ValueType), occ, "warm", nowNs() - start, BENCHNUM - (int)addr.size());
+		}
+	}
+	{
+		MemoryHandler<ValueType> handler(fileName);
+		int holes = BENCHNUM - (int)addr.size();
+		double start = nowNs();
+		for (int i = 0; i < holes; i++) handler.insert(&value);
+		if (holes) report("refill", sizeof(ValueType), occ, "warm", nowNs() - start, holes);
+		unlink(fileName);
+	}
+
+	MemoryHandler<ValueType> handler(fileName);
+	addr.clear();
+	fill(handler, addr);
+	thin(handler, addr, occ);
+	measure<ValueType>("getValue", occ, addr, [&](long long a) { volatile char sink = handler.getValue(a).data[0]; (void)sink; });
+	measure<ValueType>("update", occ, addr, [&](long long a) { handler.update(a, &value); });
+	measure<ValueType>("getAddr", occ, addr, [&](long long a) { volatile char sink = *(char*)handler.getAddr(a); (void)sink; handler.unMapAddr(a); });
+
+	vector<long long> order(addr);
+	random_shuffle(order.begin(), order.end());
+	evictCache();
+	double start = nowNs();
+	for (int i = 0; i < (int)order.size(); i++) handler.remove(order[i]);
+	report("remove", sizeof(ValueType), occ, "cold", nowNs() - start, (int)order.size());
+	unlink(fileName);
+}
+
+template<typename ValueType>
+void runAllOccupancy()
+{
+	runSuite<ValueType>(FULL);
+	runSuite<ValueType>(HALF);
+	runSuite<ValueType>(SPARSE);
+}
+
+void runTreeInsert(bool sequential)
+{
+	const char* indexName = "benchIndex.dat";
+	const char* keyName = "benchKey.dat";
+	const char* dataName = "benchValue.dat";
+	unlink(indexName);
+	unlink(keyName);
+	unlink(dataName);
+	vector<int> keys;
+	for (int i = 0; i < TREENUM; i++) keys.push_back(i);
+	if (!sequential) random_shuffle(keys.begin(), keys.end());
+	{
+		BPlusMap<int, long long> tree(indexName, keyName, dataName);
+		evictCache();
+		double start = nowNs();
+		for (int i = 0; i < TREENUM; i++) tree.insert(keys[i], (long long)keys[i]);
+		printf("%-10s keys=%-5d order=%-10s %10.1f ns/op\n", "treeInsert", TREENUM, sequential ? "sequential" : "random", (nowNs() - start) / TREENUM);
+	}
+	unlink(indexName);
+	unlink(keyName);
+	unlink(dataName);
+}
+
+int main()
+{
+	srand(1);
+	runAllOccupancy<Blob<8> >();
+	runAllOccupancy<Blob<64> >();
+	runAllOccupancy<Blob<512> >();
+	runAllOccupancy<Blob<2048> >();
+	runTreeInsert(true);
+	runTreeInsert(false);
+	delete[] evictBuffer;
+	return 0;
+}